@@ -65,14 +65,21 @@ double CAddrInfo::GetChance(int64_t nNow) const
     return fChance;
 }
 
+SaltedNetAddrHasher::SaltedNetAddrHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+size_t SaltedNetAddrHasher::operator()(const CNetAddr& addr) const
+{
+    return addr.GetSaltedHash(k0, k1);
+}
+
 CAddrInfo* CAddrMan::Find(const CNetAddr& addr, int* pnId)
 {
-    std::map<CNetAddr, int>::iterator it = mapAddr.find(addr);
+    auto it = mapAddr.find(addr);
     if (it == mapAddr.end())
         return nullptr;
     if (pnId)
         *pnId = (*it).second;
-    std::map<int, CAddrInfo>::iterator it2 = mapInfo.find((*it).second);
+    auto it2 = mapInfo.find((*it).second);
     if (it2 != mapInfo.end())
         return &(*it2).second;
     return nullptr;
@@ -85,6 +92,7 @@ CAddrInfo* CAddrMan::Create(const CAddress& addr, const CNetAddr& addrSource, in
     mapAddr[addr] = nId;
     mapInfo[nId].nRandomPos = vRandom.size();
     vRandom.push_back(nId);
+    m_size = vRandom.size();
     if (pnId)
         *pnId = nId;
     return &mapInfo[nId];
@@ -119,6 +127,7 @@ void CAddrMan::Delete(int nId)
 
     SwapRandom(info.nRandomPos, vRandom.size() - 1);
     vRandom.pop_back();
+    m_size = vRandom.size();
     mapAddr.erase(info);
     mapInfo.erase(nId);
     nNew--;
@@ -217,7 +226,7 @@ void CAddrMan::Good_(const CService& addr, bool test_before_evict, int64_t nTime
         return;
 
     // find a bucket it is in now
-    int nRnd = RandomInt(ADDRMAN_NEW_BUCKET_COUNT);
+    int nRnd = RandomInt(ADDRMAN_NEW_BUCKET_COUNT, insecure_rand);
     int nUBucket = -1;
     for (unsigned int n = 0; n < ADDRMAN_NEW_BUCKET_COUNT; n++) {
         int nB = (n + nRnd) % ADDRMAN_NEW_BUCKET_COUNT;
@@ -251,7 +260,24 @@ void CAddrMan::Good_(const CService& addr, bool test_before_evict, int64_t nTime
     }
 }
 
-bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimePenalty)
+std::vector<CAddrMan::NewTablePosition> CAddrMan::GetNewTablePositions(const std::vector<CAddress>& vAddr, const CNetAddr& source, uint256& nKeyUsed) const
+{
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs);
+        nKeyUsed = nKey;
+    }
+    std::vector<NewTablePosition> vPos(vAddr.size());
+    for (size_t i = 0; i < vAddr.size(); i++) {
+        if (!vAddr[i].IsRoutable())
+            continue;
+        const CAddrInfo info(vAddr[i], source);
+        vPos[i].nBucket = info.GetNewBucket(nKeyUsed);
+        vPos[i].nBucketPos = info.GetBucketPosition(nKeyUsed, true, vPos[i].nBucket);
+    }
+    return vPos;
+}
+
+bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimePenalty, const NewTablePosition* pos)
 {
     if (!addr.IsRoutable())
         return false;
@@ -291,7 +317,7 @@ bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimeP
         int nFactor = 1;
         for (int n = 0; n < pinfo->nRefCount; n++)
             nFactor *= 2;
-        if (nFactor > 1 && (RandomInt(nFactor) != 0))
+        if (nFactor > 1 && (RandomInt(nFactor, insecure_rand) != 0))
             return false;
     } else {
         pinfo = Create(addr, source, &nId);
@@ -300,8 +326,15 @@ bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimeP
         fNew = true;
     }
 
-    int nUBucket = pinfo->GetNewBucket(nKey, source);
-    int nUBucketPos = pinfo->GetBucketPosition(nKey, true, nUBucket);
+    int nUBucket, nUBucketPos;
+    if (pos && pinfo->GetPort() == addr.GetPort()) {
+        // The position also depends on the port, which an existing entry may not share.
+        nUBucket = pos->nBucket;
+        nUBucketPos = pos->nBucketPos;
+    } else {
+        nUBucket = pinfo->GetNewBucket(nKey, source);
+        nUBucketPos = pinfo->GetBucketPosition(nKey, true, nUBucket);
+    }
     if (vvNew[nUBucket][nUBucketPos] != nId) {
         bool fInsert = vvNew[nUBucket][nUBucketPos] == -1;
         if (!fInsert) {
@@ -346,7 +379,7 @@ void CAddrMan::Attempt_(const CService& addr, bool fCountFailure, int64_t nTime)
     }
 }
 
-CAddrInfo CAddrMan::Select_(bool newOnly)
+CAddrInfo CAddrMan::Select_(bool newOnly, FastRandomContext& rng) const
 {
     if (size() == 0)
         return CAddrInfo();
@@ -354,22 +387,24 @@ CAddrInfo CAddrMan::Select_(bool newOnly)
     if (newOnly && nNew == 0)
         return CAddrInfo();
 
+    const int64_t nNow = GetAdjustedTime();
+
     // Use a 50% chance for choosing between tried and new table entries.
     if (!newOnly &&
-       (nTried > 0 && (nNew == 0 || RandomInt(2) == 0))) {
+       (nTried > 0 && (nNew == 0 || RandomInt(2, rng) == 0))) {
         // use a tried node
         double fChanceFactor = 1.0;
         while (1) {
-            int nKBucket = RandomInt(ADDRMAN_TRIED_BUCKET_COUNT);
-            int nKBucketPos = RandomInt(ADDRMAN_BUCKET_SIZE);
+            int nKBucket = RandomInt(ADDRMAN_TRIED_BUCKET_COUNT, rng);
+            int nKBucketPos = RandomInt(ADDRMAN_BUCKET_SIZE, rng);
             while (vvTried[nKBucket][nKBucketPos] == -1) {
-                nKBucket = (nKBucket + insecure_rand.randbits(ADDRMAN_TRIED_BUCKET_COUNT_LOG2)) % ADDRMAN_TRIED_BUCKET_COUNT;
-                nKBucketPos = (nKBucketPos + insecure_rand.randbits(ADDRMAN_BUCKET_SIZE_LOG2)) % ADDRMAN_BUCKET_SIZE;
+                nKBucket = (nKBucket + rng.randbits(ADDRMAN_TRIED_BUCKET_COUNT_LOG2)) % ADDRMAN_TRIED_BUCKET_COUNT;
+                nKBucketPos = (nKBucketPos + rng.randbits(ADDRMAN_BUCKET_SIZE_LOG2)) % ADDRMAN_BUCKET_SIZE;
             }
             int nId = vvTried[nKBucket][nKBucketPos];
             assert(mapInfo.count(nId) == 1);
-            CAddrInfo& info = mapInfo[nId];
-            if (RandomInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
+            const CAddrInfo& info = mapInfo.at(nId);
+            if (RandomInt(1 << 30, rng) < fChanceFactor * info.GetChance(nNow) * (1 << 30))
                 return info;
             fChanceFactor *= 1.2;
         }
@@ -377,16 +412,16 @@ CAddrInfo CAddrMan::Select_(bool newOnly)
         // use a new node
         double fChanceFactor = 1.0;
         while (1) {
-            int nUBucket = RandomInt(ADDRMAN_NEW_BUCKET_COUNT);
-            int nUBucketPos = RandomInt(ADDRMAN_BUCKET_SIZE);
+            int nUBucket = RandomInt(ADDRMAN_NEW_BUCKET_COUNT, rng);
+            int nUBucketPos = RandomInt(ADDRMAN_BUCKET_SIZE, rng);
             while (vvNew[nUBucket][nUBucketPos] == -1) {
-                nUBucket = (nUBucket + insecure_rand.randbits(ADDRMAN_NEW_BUCKET_COUNT_LOG2)) % ADDRMAN_NEW_BUCKET_COUNT;
-                nUBucketPos = (nUBucketPos + insecure_rand.randbits(ADDRMAN_BUCKET_SIZE_LOG2)) % ADDRMAN_BUCKET_SIZE;
+                nUBucket = (nUBucket + rng.randbits(ADDRMAN_NEW_BUCKET_COUNT_LOG2)) % ADDRMAN_NEW_BUCKET_COUNT;
+                nUBucketPos = (nUBucketPos + rng.randbits(ADDRMAN_BUCKET_SIZE_LOG2)) % ADDRMAN_BUCKET_SIZE;
             }
             int nId = vvNew[nUBucket][nUBucketPos];
             assert(mapInfo.count(nId) == 1);
-            CAddrInfo& info = mapInfo[nId];
-            if (RandomInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
+            const CAddrInfo& info = mapInfo.at(nId);
+            if (RandomInt(1 << 30, rng) < fChanceFactor * info.GetChance(nNow) * (1 << 30))
                 return info;
             fChanceFactor *= 1.2;
         }
@@ -394,7 +429,7 @@ CAddrInfo CAddrMan::Select_(bool newOnly)
 }
 
 #ifdef DEBUG_ADDRMAN
-int CAddrMan::Check_()
+int CAddrMan::Check_() const
 {
     std::set<int> setTried;
     std::map<int, int> mapNew;
@@ -418,7 +453,8 @@ int CAddrMan::Check_()
                 return -4;
             mapNew[n] = info.nRefCount;
         }
-        if (mapAddr[info] != n)
+        const auto itAddr = mapAddr.find(info);
+        if (itAddr == mapAddr.end() || itAddr->second != n)
             return -5;
         if (info.nRandomPos < 0 || (size_t)info.nRandomPos >= vRandom.size() || vRandom[info.nRandomPos] != n)
             return -14;
@@ -438,9 +474,9 @@ int CAddrMan::Check_()
              if (vvTried[n][i] != -1) {
                  if (!setTried.count(vvTried[n][i]))
                      return -11;
-                 if (mapInfo[vvTried[n][i]].GetTriedBucket(nKey) != n)
+                 if (mapInfo.at(vvTried[n][i]).GetTriedBucket(nKey) != n)
                      return -17;
-                 if (mapInfo[vvTried[n][i]].GetBucketPosition(nKey, false, n) != i)
+                 if (mapInfo.at(vvTried[n][i]).GetBucketPosition(nKey, false, n) != i)
                      return -18;
                  setTried.erase(vvTried[n][i]);
              }
@@ -452,7 +488,7 @@ int CAddrMan::Check_()
             if (vvNew[n][i] != -1) {
                 if (!mapNew.count(vvNew[n][i]))
                     return -12;
-                if (mapInfo[vvNew[n][i]].GetBucketPosition(nKey, true, n) != i)
+                if (mapInfo.at(vvNew[n][i]).GetBucketPosition(nKey, true, n) != i)
                     return -19;
                 if (--mapNew[vvNew[n][i]] == 0)
                     mapNew.erase(vvNew[n][i]);
@@ -471,23 +507,27 @@ int CAddrMan::Check_()
 }
 #endif
 
-void CAddrMan::GetAddr_(std::vector<CAddress>& vAddr)
+void CAddrMan::GetAddr_(std::vector<CAddress>& vAddr, FastRandomContext& rng) const
 {
     unsigned int nNodes = ADDRMAN_GETADDR_MAX_PCT * vRandom.size() / 100;
     if (nNodes > ADDRMAN_GETADDR_MAX)
         nNodes = ADDRMAN_GETADDR_MAX;
 
-    // gather a list of random nodes, skipping those of low quality
-    for (unsigned int n = 0; n < vRandom.size(); n++) {
+    // gather a list of random nodes, skipping those of low quality. Other
+    // readers may be running too, so shuffle a copy of vRandom rather than
+    // vRandom itself.
+    std::vector<int> vShuffled(vRandom);
+    const int64_t nNow = GetAdjustedTime();
+    for (unsigned int n = 0; n < vShuffled.size(); n++) {
         if (vAddr.size() >= nNodes)
             break;
 
-        int nRndPos = RandomInt(vRandom.size() - n) + n;
-        SwapRandom(n, nRndPos);
-        assert(mapInfo.count(vRandom[n]) == 1);
+        int nRndPos = RandomInt(vShuffled.size() - n, rng) + n;
+        std::swap(vShuffled[n], vShuffled[nRndPos]);
+        assert(mapInfo.count(vShuffled[n]) == 1);
 
-        const CAddrInfo& ai = mapInfo[vRandom[n]];
-        if (!ai.IsTerrible())
+        const CAddrInfo& ai = mapInfo.at(vShuffled[n]);
+        if (!ai.IsTerrible(nNow))
             vAddr.push_back(ai);
     }
 }
@@ -530,8 +570,33 @@ void CAddrMan::SetServices_(const CService& addr, ServiceFlags nServices)
     info.nServices = nServices;
 }
 
-int CAddrMan::RandomInt(int nMax){
-    return GetRandInt(nMax);
+int CAddrMan::RandomInt(int nMax, FastRandomContext& rng) const
+{
+    return rng.randrange(nMax);
+}
+
+void CAddrMan::Clear_()
+{
+    std::vector<int>().swap(vRandom);
+    nKey = GetRandHash();
+    for (size_t bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
+        for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
+            vvNew[bucket][entry] = -1;
+        }
+    }
+    for (size_t bucket = 0; bucket < ADDRMAN_TRIED_BUCKET_COUNT; bucket++) {
+        for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
+            vvTried[bucket][entry] = -1;
+        }
+    }
+
+    nIdCount = 0;
+    nTried = 0;
+    nNew = 0;
+    nLastGood = 1; //Initially at 1 so that "never" is strictly worse.
+    mapInfo.clear();
+    mapAddr.clear();
+    m_size = 0;
 }
 
 void CAddrMan::ResolveCollisions_()
@@ -13,11 +13,15 @@
 #include <timedata.h>
 #include <util.h>
 
+#include <atomic>
 #include <map>
 #include <set>
 #include <stdint.h>
+#include <unordered_map>
 #include <vector>
 
+#include <boost/thread/shared_mutex.hpp>
+
 /**
  * Extended statistics about a CAddress
  */
@@ -182,27 +186,44 @@ public:
 //! the maximum number of tried addr collisions to store
 #define ADDRMAN_SET_TRIED_COLLISION_SIZE 10
 
+/** Salted hasher for CNetAddr-keyed unordered maps, so peers cannot pick addresses that collide. */
+class SaltedNetAddrHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    SaltedNetAddrHasher();
+
+    size_t operator()(const CNetAddr& addr) const;
+};
+
 /**
  * Stochastical (IP) address manager
  */
 class CAddrMan
 {
 private:
-    //! critical section to protect the inner data structures
-    mutable CCriticalSection cs;
+    //! lock to protect the inner data structures. Select and GetAddr only read
+    //! them, so they take it shared and can run on several threads at once.
+    mutable boost::shared_mutex cs;
 
     //! last used nId
     int nIdCount;
 
     //! table with information about all nIds
-    std::map<int, CAddrInfo> mapInfo;
+    std::unordered_map<int, CAddrInfo> mapInfo;
 
     //! find an nId based on its network address
-    std::map<CNetAddr, int> mapAddr;
+    std::unordered_map<CNetAddr, int, SaltedNetAddrHasher> mapAddr;
 
     //! randomly-ordered vector of all nIds
     std::vector<int> vRandom;
 
+    //! vRandom.size(), readable without taking cs
+    std::atomic<size_t> m_size;
+
     // number of "tried" entries
     int nTried;
 
@@ -225,9 +246,13 @@ protected:
     //! secret key to randomize bucket select with
     uint256 nKey;
 
-    //! Source of random numbers for randomization in inner loops
+    //! Source of random numbers for randomization in inner loops of writers,
+    //! which hold cs exclusively. Readers use a context of their own.
     FastRandomContext insecure_rand;
 
+    //! Give readers a deterministic random context (for tests)
+    bool m_deterministic_readers = false;
+
     //! Find an entry.
     CAddrInfo* Find(const CNetAddr& addr, int *pnId = nullptr);
 
@@ -250,14 +275,24 @@ protected:
     //! Mark an entry "good", possibly moving it from "new" to "tried".
     void Good_(const CService &addr, bool test_before_evict, int64_t time);
 
-    //! Add an entry to the "new" table.
-    bool Add_(const CAddress &addr, const CNetAddr& source, int64_t nTimePenalty);
+    //! A bucket and position in the "new" table.
+    struct NewTablePosition {
+        int nBucket;
+        int nBucketPos;
+    };
+
+    //! Compute where each of vAddr, learned from source, goes in the "new" table. Takes cs only
+    //! briefly: the hashing is done without it, so that concurrent Add calls do not serialize on it.
+    std::vector<NewTablePosition> GetNewTablePositions(const std::vector<CAddress> &vAddr, const CNetAddr& source, uint256& nKeyUsed) const;
+
+    //! Add an entry to the "new" table, optionally with its position as computed by GetNewTablePositions.
+    bool Add_(const CAddress &addr, const CNetAddr& source, int64_t nTimePenalty, const NewTablePosition* pos = nullptr);
 
     //! Mark an entry as attempted to connect.
     void Attempt_(const CService &addr, bool fCountFailure, int64_t nTime);
 
     //! Select an address to connect to, if newOnly is set to true, only the new table is selected from.
-    CAddrInfo Select_(bool newOnly);
+    CAddrInfo Select_(bool newOnly, FastRandomContext& rng) const;
 
     //! See if any to-be-evicted tried table entries have been tested and if so resolve the collisions.
     void ResolveCollisions_();
@@ -265,16 +300,16 @@ protected:
     //! Return a random to-be-evicted tried table address.
     CAddrInfo SelectTriedCollision_();
 
-    //! Wraps GetRandInt to allow tests to override RandomInt and make it determinismistic.
-    virtual int RandomInt(int nMax);
+    //! Draws from rng; tests override RandomInt to make it deterministic.
+    virtual int RandomInt(int nMax, FastRandomContext& rng) const;
 
 #ifdef DEBUG_ADDRMAN
     //! Perform consistency check. Returns an error code or zero.
-    int Check_();
+    int Check_() const;
 #endif
 
     //! Select several addresses at once.
-    void GetAddr_(std::vector<CAddress> &vAddr);
+    void GetAddr_(std::vector<CAddress> &vAddr, FastRandomContext& rng) const;
 
     //! Mark an entry as currently-connected-to.
     void Connected_(const CService &addr, int64_t nTime);
@@ -282,6 +317,19 @@ protected:
     //! Update an entry's service bits.
     void SetServices_(const CService &addr, ServiceFlags nServices);
 
+    //! Empty the tables and pick a new key.
+    void Clear_();
+
+    //! Consistency check. cs must be held, shared or exclusively.
+    void Check() const
+    {
+#ifdef DEBUG_ADDRMAN
+        int err;
+        if ((err=Check_()))
+            LogPrintf("ADDRMAN CONSISTENCY CHECK FAILED!!! err=%i\n", err);
+#endif
+    }
+
 public:
     /**
      * serialized format:
@@ -315,7 +363,7 @@ public:
     template<typename Stream>
     void Serialize(Stream &s) const
     {
-        LOCK(cs);
+        boost::shared_lock<boost::shared_mutex> lock(cs);
 
         unsigned char nVersion = 1;
         s << nVersion;
@@ -365,9 +413,9 @@ public:
     template<typename Stream>
     void Unserialize(Stream& s)
     {
-        LOCK(cs);
+        boost::unique_lock<boost::shared_mutex> lock(cs);
 
-        Clear();
+        Clear_();
 
         unsigned char nVersion;
         s >> nVersion;
@@ -398,6 +446,7 @@ public:
             mapAddr[info] = n;
             info.nRandomPos = vRandom.size();
             vRandom.push_back(n);
+            m_size = vRandom.size();
             if (nVersion != 1 || nUBuckets != ADDRMAN_NEW_BUCKET_COUNT) {
                 // In case the new table data cannot be used (nVersion unknown, or bucket count wrong),
                 // immediately try to give them a reference based on their primary source address.
@@ -422,6 +471,7 @@ public:
                 info.nRandomPos = vRandom.size();
                 info.fInTried = true;
                 vRandom.push_back(nIdCount);
+                m_size = vRandom.size();
                 mapInfo[nIdCount] = info;
                 mapAddr[info] = nIdCount;
                 vvTried[nKBucket][nKBucketPos] = nIdCount;
@@ -452,9 +502,9 @@ public:
 
         // Prune new entries with refcount 0 (as a result of collisions).
         int nLostUnk = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); ) {
+        for (std::unordered_map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); ) {
             if (it->second.fInTried == false && it->second.nRefCount == 0) {
-                std::map<int, CAddrInfo>::const_iterator itCopy = it++;
+                std::unordered_map<int, CAddrInfo>::const_iterator itCopy = it++;
                 Delete(itCopy->first);
                 nLostUnk++;
             } else {
@@ -470,31 +520,13 @@ public:
 
     void Clear()
     {
-        LOCK(cs);
-        std::vector<int>().swap(vRandom);
-        nKey = GetRandHash();
-        for (size_t bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
-            for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
-                vvNew[bucket][entry] = -1;
-            }
-        }
-        for (size_t bucket = 0; bucket < ADDRMAN_TRIED_BUCKET_COUNT; bucket++) {
-            for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
-                vvTried[bucket][entry] = -1;
-            }
-        }
-
-        nIdCount = 0;
-        nTried = 0;
-        nNew = 0;
-        nLastGood = 1; //Initially at 1 so that "never" is strictly worse.
-        mapInfo.clear();
-        mapAddr.clear();
+        boost::unique_lock<boost::shared_mutex> lock(cs);
+        Clear_();
     }
 
     CAddrMan()
     {
-        Clear();
+        Clear_();
     }
 
     ~CAddrMan()
@@ -505,30 +537,18 @@ public:
     //! Return the number of (unique) addresses in all tables.
     size_t size() const
     {
-        LOCK(cs); // TODO: Cache this in an atomic to avoid this overhead
-        return vRandom.size();
-    }
-
-    //! Consistency check
-    void Check()
-    {
-#ifdef DEBUG_ADDRMAN
-        {
-            LOCK(cs);
-            int err;
-            if ((err=Check_()))
-                LogPrintf("ADDRMAN CONSISTENCY CHECK FAILED!!! err=%i\n", err);
-        }
-#endif
+        return m_size;
     }
 
     //! Add a single address.
     bool Add(const CAddress &addr, const CNetAddr& source, int64_t nTimePenalty = 0)
     {
-        LOCK(cs);
+        uint256 nKeyUsed;
+        const std::vector<NewTablePosition> vPos = GetNewTablePositions({addr}, source, nKeyUsed);
+        boost::unique_lock<boost::shared_mutex> lock(cs);
         bool fRet = false;
         Check();
-        fRet |= Add_(addr, source, nTimePenalty);
+        fRet |= Add_(addr, source, nTimePenalty, nKeyUsed == nKey ? &vPos[0] : nullptr);
         Check();
         if (fRet) {
             LogPrint(BCLog::ADDRMAN, "Added %s from %s: %i tried, %i new\n", addr.ToStringIPPort(), source.ToString(), nTried, nNew);
@@ -539,11 +559,16 @@ public:
     //! Add multiple addresses.
     bool Add(const std::vector<CAddress> &vAddr, const CNetAddr& source, int64_t nTimePenalty = 0)
     {
-        LOCK(cs);
+        uint256 nKeyUsed;
+        const std::vector<NewTablePosition> vPos = GetNewTablePositions(vAddr, source, nKeyUsed);
+        boost::unique_lock<boost::shared_mutex> lock(cs);
         int nAdd = 0;
         Check();
-        for (std::vector<CAddress>::const_iterator it = vAddr.begin(); it != vAddr.end(); it++)
-            nAdd += Add_(*it, source, nTimePenalty) ? 1 : 0;
+        // The positions are only usable if the key did not change (through Clear or
+        // Unserialize) while they were being computed.
+        const bool fUsePos = nKeyUsed == nKey;
+        for (size_t i = 0; i < vAddr.size(); i++)
+            nAdd += Add_(vAddr[i], source, nTimePenalty, fUsePos ? &vPos[i] : nullptr) ? 1 : 0;
         Check();
         if (nAdd) {
             LogPrint(BCLog::ADDRMAN, "Added %i addresses from %s: %i tried, %i new\n", nAdd, source.ToString(), nTried, nNew);
@@ -554,7 +579,7 @@ public:
     //! Mark an entry as accessible.
     void Good(const CService &addr, bool test_before_evict = true, int64_t nTime = GetAdjustedTime())
     {
-        LOCK(cs);
+        boost::unique_lock<boost::shared_mutex> lock(cs);
         Check();
         Good_(addr, test_before_evict, nTime);
         Check();
@@ -563,7 +588,7 @@ public:
     //! Mark an entry as connection attempted to.
     void Attempt(const CService &addr, bool fCountFailure, int64_t nTime = GetAdjustedTime())
     {
-        LOCK(cs);
+        boost::unique_lock<boost::shared_mutex> lock(cs);
         Check();
         Attempt_(addr, fCountFailure, nTime);
         Check();
@@ -572,7 +597,7 @@ public:
     //! See if any to-be-evicted tried table entries have been tested and if so resolve the collisions.
     void ResolveCollisions()
     {
-        LOCK(cs);
+        boost::unique_lock<boost::shared_mutex> lock(cs);
         Check();
         ResolveCollisions_();
         Check();
@@ -583,7 +608,7 @@ public:
     {
         CAddrInfo ret;
         {
-            LOCK(cs);
+            boost::unique_lock<boost::shared_mutex> lock(cs);
             Check();
             ret = SelectTriedCollision_();
             Check();
@@ -594,35 +619,29 @@ public:
     /**
      * Choose an address to connect to.
      */
-    CAddrInfo Select(bool newOnly = false)
+    CAddrInfo Select(bool newOnly = false) const
     {
-        CAddrInfo addrRet;
-        {
-            LOCK(cs);
-            Check();
-            addrRet = Select_(newOnly);
-            Check();
-        }
-        return addrRet;
+        FastRandomContext rng(m_deterministic_readers);
+        boost::shared_lock<boost::shared_mutex> lock(cs);
+        Check();
+        return Select_(newOnly, rng);
     }
 
     //! Return a bunch of addresses, selected at random.
-    std::vector<CAddress> GetAddr()
+    std::vector<CAddress> GetAddr() const
     {
-        Check();
+        FastRandomContext rng(m_deterministic_readers);
         std::vector<CAddress> vAddr;
-        {
-            LOCK(cs);
-            GetAddr_(vAddr);
-        }
+        boost::shared_lock<boost::shared_mutex> lock(cs);
         Check();
+        GetAddr_(vAddr, rng);
         return vAddr;
     }
 
     //! Mark an entry as currently-connected-to.
     void Connected(const CService &addr, int64_t nTime = GetAdjustedTime())
     {
-        LOCK(cs);
+        boost::unique_lock<boost::shared_mutex> lock(cs);
         Check();
         Connected_(addr, nTime);
         Check();
@@ -630,7 +649,7 @@ public:
 
     void SetServices(const CService &addr, ServiceFlags nServices)
     {
-        LOCK(cs);
+        boost::unique_lock<boost::shared_mutex> lock(cs);
         Check();
         SetServices_(addr, nServices);
         Check();
@@ -0,0 +1,147 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <addrman.h>
+#include <bench/bench.h>
+#include <random.h>
+
+#include <thread>
+#include <vector>
+
+// Shape of the addr traffic: NUM_SOURCES peers each relay NUM_ADDRS_PER_SOURCE
+// addresses, handled by NUM_THREADS message handler threads at once.
+static const int NUM_SOURCES = 64;
+static const int NUM_ADDRS_PER_SOURCE = 256;
+static const int NUM_THREADS = 4;
+
+static std::vector<CNetAddr> g_sources;
+static std::vector<std::vector<CAddress>> g_addresses;
+
+static CNetAddr RandomIPv4(FastRandomContext& rng)
+{
+    uint8_t ip[4];
+    do {
+        // Keep the first octet in 1.0.0.0 - 126.255.255.255, clear of most reserved ranges.
+        ip[0] = 1 + rng.randrange(126);
+        ip[1] = rng.randbits(8);
+        ip[2] = rng.randbits(8);
+        ip[3] = rng.randbits(8);
+        struct in_addr ipv4;
+        memcpy(&ipv4, ip, sizeof(ip));
+        CNetAddr addr(ipv4);
+        if (addr.IsRoutable()) return addr;
+    } while (true);
+}
+
+static void CreateAddresses()
+{
+    if (!g_sources.empty()) return;
+
+    FastRandomContext rng(uint256(std::vector<unsigned char>(32, 123)));
+    for (int s = 0; s < NUM_SOURCES; s++) {
+        g_sources.push_back(RandomIPv4(rng));
+        g_addresses.emplace_back();
+        for (int a = 0; a < NUM_ADDRS_PER_SOURCE; a++) {
+            CAddress addr(CService(RandomIPv4(rng), 8333), NODE_NETWORK);
+            addr.nTime = GetAdjustedTime() - rng.randrange(60 * 60 * 24 * 7);
+            g_addresses.back().push_back(addr);
+        }
+    }
+}
+
+static void AddAddressesToAddrMan(CAddrMan& addrman)
+{
+    for (int s = 0; s < NUM_SOURCES; s++) {
+        addrman.Add(g_addresses[s], g_sources[s]);
+    }
+}
+
+// Process the addr messages of many peers on several threads at once.
+static void AddrManAdd(benchmark::State& state)
+{
+    CreateAddresses();
+
+    while (state.KeepRunning()) {
+        CAddrMan addrman;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < NUM_THREADS; t++) {
+            threads.emplace_back([&addrman, t] {
+                for (int s = t; s < NUM_SOURCES; s += NUM_THREADS) {
+                    addrman.Add(g_addresses[s], g_sources[s]);
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+}
+
+static void AddrManSelect(benchmark::State& state)
+{
+    CreateAddresses();
+    CAddrMan addrman;
+    AddAddressesToAddrMan(addrman);
+
+    while (state.KeepRunning()) {
+        const CAddrInfo address = addrman.Select();
+        assert(address.GetPort() > 0);
+    }
+}
+
+static void AddrManGetAddr(benchmark::State& state)
+{
+    CreateAddresses();
+    CAddrMan addrman;
+    AddAddressesToAddrMan(addrman);
+
+    while (state.KeepRunning()) {
+        const std::vector<CAddress> addresses = addrman.GetAddr();
+        assert(!addresses.empty());
+    }
+}
+
+// Pick addresses to connect to while answering getaddr requests, from several
+// threads at once, as ThreadOpenConnections and the message handlers do. Each
+// thread does the same work, so on a host with enough cores a round takes as
+// long with NUM_THREADS threads as with one if the readers do not serialize.
+static void SelectGetAddrOnThreads(benchmark::State& state, int num_threads)
+{
+    CreateAddresses();
+    CAddrMan addrman;
+    AddAddressesToAddrMan(addrman);
+
+    while (state.KeepRunning()) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; t++) {
+            threads.emplace_back([&addrman] {
+                for (int i = 0; i < 100; i++) {
+                    const CAddrInfo address = addrman.Select();
+                    assert(address.GetPort() > 0);
+                }
+                const std::vector<CAddress> addresses = addrman.GetAddr();
+                assert(!addresses.empty());
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+}
+
+static void AddrManSelectGetAddrOneThread(benchmark::State& state)
+{
+    SelectGetAddrOnThreads(state, 1);
+}
+
+static void AddrManSelectGetAddrConcurrent(benchmark::State& state)
+{
+    SelectGetAddrOnThreads(state, NUM_THREADS);
+}
+
+BENCHMARK(AddrManAdd, 5);
+BENCHMARK(AddrManSelect, 100000);
+BENCHMARK(AddrManGetAddr, 500);
+BENCHMARK(AddrManSelectGetAddrOneThread, 50);
+BENCHMARK(AddrManSelectGetAddrConcurrent, 50);
@@ -102,5 +102,51 @@ static void BnBExhaustion(benchmark::State& state)
     }
 }
 
+// A pool the size of a large wallet, with values spread over several orders of magnitude so that
+// neither solver finds an exact match among the first few candidates.
+static const int LARGE_POOL_SIZE = 100000;
+
+static void make_large_pool(std::vector<OutputGroup>& utxo_pool)
+{
+    FastRandomContext rand(true);
+    utxo_pool.clear();
+    utxo_pool.reserve(LARGE_POOL_SIZE);
+    for (int i = 0; i < LARGE_POOL_SIZE; ++i) {
+        add_coin(1000 + rand.randrange(100 * COIN) / (1 + rand.randrange(1000)), i, utxo_pool);
+    }
+}
+
+static void BnBLargePool(benchmark::State& state)
+{
+    std::vector<OutputGroup> utxo_pool;
+    make_large_pool(utxo_pool);
+    CoinSet selection;
+    CAmount value_ret = 0;
+    CAmount not_input_fees = 0;
+
+    while (state.KeepRunning()) {
+        std::vector<OutputGroup> pool(utxo_pool);
+        bool success = SelectCoinsBnB(pool, 5 * COIN + 12345, 10000, selection, value_ret, not_input_fees);
+        assert(success);
+        selection.clear();
+    }
+}
+
+static void KnapsackLargePool(benchmark::State& state)
+{
+    std::vector<OutputGroup> utxo_pool;
+    make_large_pool(utxo_pool);
+    CoinSet selection;
+    CAmount value_ret = 0;
+
+    while (state.KeepRunning()) {
+        bool success = KnapsackSolver(5 * COIN + 12345, utxo_pool, selection, value_ret);
+        assert(success);
+        selection.clear();
+    }
+}
+
 BENCHMARK(CoinSelection, 650);
 BENCHMARK(BnBExhaustion, 650);
+BENCHMARK(BnBLargePool, 5);
+BENCHMARK(KnapsackLargePool, 5);
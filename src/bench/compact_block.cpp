@@ -0,0 +1,75 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <blockencodings.h>
+#include <consensus/merkle.h>
+#include <random.h>
+#include <txmempool.h>
+
+#include <vector>
+
+static void AddTx(const CTransactionRef& tx, const CAmount& nFee, CTxMemPool& pool) EXCLUSIVE_LOCKS_REQUIRED(pool.cs)
+{
+    int64_t nTime = 0;
+    double dPriority = 10.0;
+    unsigned int nHeight = 1;
+    bool spendsCoinbase = false;
+    unsigned int sigOpCost = 4;
+    LockPoints lp;
+    pool.addUnchecked(tx->GetHash(), CTxMemPoolEntry(
+                                         tx, nFee, nTime, dPriority, nHeight,
+                                         tx->GetValueOut(), spendsCoinbase, sigOpCost, lp));
+}
+
+// Reconstruct a compact block of 2500 transactions against a 100k-transaction
+// mempool, i.e. the work done for every cmpctblock received from a peer.
+static void CompactBlockReconstruct(benchmark::State& state)
+{
+    const int num_pool_txs = 100000;
+    const int num_block_txs = 2500;
+    FastRandomContext det_rand(true);
+
+    CTxMemPool pool;
+    std::vector<CTransactionRef> pool_txs;
+    pool_txs.reserve(num_pool_txs);
+    {
+        LOCK(pool.cs);
+        for (int i = 0; i < num_pool_txs; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = COutPoint(det_rand.rand256(), 0);
+            tx.vin[0].scriptWitness.stack.push_back({1});
+            tx.vout.resize(1);
+            tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+            tx.vout[0].nValue = 10 * COIN;
+            pool_txs.push_back(MakeTransactionRef(tx));
+            AddTx(pool_txs.back(), 1000, pool);
+        }
+    }
+
+    CBlock block;
+    block.nBits = 0x207fffff;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50 * COIN;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    for (int i = 0; i < num_pool_txs && (int)block.vtx.size() <= num_block_txs; i++) {
+        if (det_rand.randrange(num_pool_txs / num_block_txs) == 0) {
+            block.vtx.push_back(pool_txs[i]);
+        }
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    const CBlockHeaderAndShortTxIDs cmpctblock(block, true);
+    const std::vector<std::pair<uint256, CTransactionRef>> extra_txn;
+
+    while (state.KeepRunning()) {
+        PartiallyDownloadedBlock partial_block(&pool);
+        ReadStatus status = partial_block.InitData(cmpctblock, extra_txn);
+        assert(status == READ_STATUS_OK);
+    }
+}
+
+BENCHMARK(CompactBlockReconstruct, 50);
@@ -0,0 +1,68 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <key.h>
+#include <keystore.h>
+#include <script/ismine.h>
+#include <script/standard.h>
+
+#include <vector>
+
+static constexpr int NUM_KEYS = 100000;
+static constexpr int NUM_FOREIGN_SCRIPTS = 1000;
+static constexpr int NUM_OWN_SCRIPTS = 10;
+
+// Fills a key store the size of a large wallet, and returns the scripts of
+// the outputs of a block-sized batch of transactions: mostly paying to other
+// people, with a few paying to the key store.
+static std::vector<CScript> SetupKeyStore(CBasicKeyStore& keystore)
+{
+    std::vector<CScript> scripts;
+    for (int i = 0; i < NUM_KEYS; ++i) {
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+        if (i < NUM_OWN_SCRIPTS) {
+            scripts.push_back(GetScriptForDestination(WitnessV0KeyHash(key.GetPubKey().GetID())));
+        }
+    }
+    for (int i = 0; i < NUM_FOREIGN_SCRIPTS; ++i) {
+        CKey key;
+        key.MakeNewKey(true);
+        scripts.push_back(GetScriptForDestination(WitnessV0KeyHash(key.GetPubKey().GetID())));
+    }
+    return scripts;
+}
+
+static void IsMineUncached(benchmark::State& state)
+{
+    CBasicKeyStore keystore;
+    const std::vector<CScript> scripts = SetupKeyStore(keystore);
+
+    while (state.KeepRunning()) {
+        int mine = 0;
+        for (const CScript& script : scripts) {
+            mine += IsMine(keystore, script) != ISMINE_NO;
+        }
+        assert(mine == NUM_OWN_SCRIPTS);
+    }
+}
+
+static void IsMineIndexed(benchmark::State& state)
+{
+    CBasicKeyStore keystore;
+    const std::vector<CScript> scripts = SetupKeyStore(keystore);
+
+    while (state.KeepRunning()) {
+        int mine = 0;
+        for (const CScript& script : scripts) {
+            mine += keystore.IsMineIndexed(script) != ISMINE_NO;
+        }
+        assert(mine == NUM_OWN_SCRIPTS);
+    }
+}
+
+BENCHMARK(IsMineUncached, 200);
+BENCHMARK(IsMineIndexed, 2000);
@@ -0,0 +1,106 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <consensus/consensus.h>
+#include <consensus/validation.h>
+#include <random.h>
+#include <txmempool.h>
+
+#include <vector>
+
+static void AddTx(const CTransactionRef& tx, const CAmount& nFee, CTxMemPool& pool) EXCLUSIVE_LOCKS_REQUIRED(pool.cs)
+{
+    int64_t nTime = 0;
+    double dPriority = 10.0;
+    unsigned int nHeight = 1;
+    bool spendsCoinbase = false;
+    unsigned int sigOpCost = 4;
+    LockPoints lp;
+    pool.addUnchecked(tx->GetHash(), CTxMemPoolEntry(
+                                         tx, nFee, nTime, dPriority, nHeight,
+                                         tx->GetValueOut(), spendsCoinbase, sigOpCost, lp));
+}
+
+// Build a transaction shaped like typical network traffic: mostly one or two
+// inputs and outputs, some consolidations and batched payouts, spending
+// P2PKH or P2WPKH outputs with signature-sized scriptSigs or witnesses.
+static CMutableTransaction MakeRealisticTx(FastRandomContext& rand, const COutPoint& parent)
+{
+    const int input_draw = rand.randrange(100);
+    const size_t num_inputs = input_draw < 60 ? 1 : input_draw < 80 ? 2 : input_draw < 95 ? 3 + rand.randrange(3) : 10 + rand.randrange(11);
+    const int output_draw = rand.randrange(100);
+    const size_t num_outputs = output_draw < 30 ? 1 : output_draw < 95 ? 2 : 10 + rand.randrange(21);
+    const bool segwit = rand.randbool();
+
+    CMutableTransaction tx;
+    tx.vin.resize(num_inputs);
+    for (size_t i = 0; i < num_inputs; i++) {
+        tx.vin[i].prevout = i == 0 && !parent.IsNull() ? parent : COutPoint(rand.rand256(), rand.randrange(4));
+        std::vector<unsigned char> sig(72, 0x30), pubkey(33, 0x02);
+        if (segwit) {
+            tx.vin[i].scriptWitness.stack = {sig, pubkey};
+        } else {
+            tx.vin[i].scriptSig = CScript() << sig << pubkey;
+        }
+    }
+    tx.vout.resize(num_outputs);
+    for (size_t i = 0; i < num_outputs; i++) {
+        tx.vout[i].nValue = COIN + rand.randrange(COIN);
+        if (segwit) {
+            tx.vout[i].scriptPubKey = CScript() << OP_0 << rand.randbytes(20);
+        } else {
+            tx.vout[i].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << rand.randbytes(20) << OP_EQUALVERIFY << OP_CHECKSIG;
+        }
+    }
+    return tx;
+}
+
+// Connect a full block against a mempool holding about twice as much. The
+// mempool is made of short chains; the block takes a random prefix of each
+// chain (as a miner would) until it reaches the block weight limit, so most
+// remaining transactions have confirmed ancestors whose removal must be
+// reflected in their ancestor state.
+static void MempoolRemoveForBlock(benchmark::State& state)
+{
+    const int chain_length = 4;
+    // Leave room for the block header and coinbase
+    const int64_t max_block_tx_weight = MAX_BLOCK_WEIGHT - 4000;
+    FastRandomContext det_rand(true);
+    std::vector<std::pair<CTransactionRef, CAmount>> txs;
+    std::vector<CTransactionRef> block_txs;
+    int64_t block_weight = 0;
+    int64_t mempool_weight = 0;
+    while (mempool_weight < 2 * max_block_tx_weight) {
+        const int num_confirmed = det_rand.randrange(chain_length + 1);
+        bool confirm = true;
+        COutPoint parent;
+        for (int j = 0; j < chain_length; j++) {
+            CTransactionRef tx = MakeTransactionRef(MakeRealisticTx(det_rand, parent));
+            const int64_t weight = GetTransactionWeight(*tx);
+            // A chain is confirmed in order, so stop at the first that does not fit
+            confirm = confirm && j < num_confirmed && block_weight + weight <= max_block_tx_weight;
+            if (confirm) {
+                block_txs.push_back(tx);
+                block_weight += weight;
+            }
+            mempool_weight += weight;
+            txs.emplace_back(tx, 1000 + det_rand.randrange(100000));
+            parent = COutPoint(tx->GetHash(), 0);
+        }
+    }
+    assert(block_weight > max_block_tx_weight * 9 / 10);
+
+    while (state.KeepRunning()) {
+        CTxMemPool pool;
+        LOCK(pool.cs);
+        for (const auto& tx : txs) {
+            AddTx(tx.first, tx.second, pool);
+        }
+        pool.removeForBlock(block_txs, 2);
+        assert(pool.size() == txs.size() - block_txs.size());
+    }
+}
+
+BENCHMARK(MempoolRemoveForBlock, 10);
@@ -4,6 +4,7 @@
 
 #include <bench/bench.h>
 #include <policy/policy.h>
+#include <random.h>
 #include <txmempool.h>
 
 #include <list>
@@ -133,3 +134,53 @@ static void MempoolEviction(benchmark::State& state)
 }
 
 BENCHMARK(MempoolEviction, 41000);
+
+// Evict most of a mempool holding many long chains, as happens when a fee
+// spike or a lowered -maxmempool forces out a large part of the pool at once.
+// Fees drop along each chain, so packages are evicted from the tail up and
+// every eviction touches the state of all remaining ancestors.
+static void MempoolEvictionMany(benchmark::State& state, bool batched)
+{
+    const int num_chains = 100;
+    const int chain_length = 25;
+    FastRandomContext det_rand(true);
+    std::vector<std::pair<CTransactionRef, CAmount>> txs;
+    txs.reserve(num_chains * chain_length);
+    for (int i = 0; i < num_chains; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << i << OP_1;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[0].nValue = 10 * COIN;
+        CAmount fee = 100000 + det_rand.randrange(10000);
+        for (int j = 0; j < chain_length; j++) {
+            txs.emplace_back(MakeTransactionRef(tx), fee);
+            tx.vin[0].prevout = COutPoint(tx.GetHash(), 0);
+            tx.vin[0].scriptSig = CScript() << OP_2;
+            fee -= 1000 + det_rand.randrange(1000);
+        }
+    }
+
+    while (state.KeepRunning()) {
+        CTxMemPool pool;
+        LOCK(pool.cs);
+        for (const auto& tx : txs) {
+            AddTx(tx.first, tx.second, pool);
+        }
+        pool.TrimToSize(pool.DynamicMemoryUsage() / 10, nullptr, batched);
+    }
+}
+
+static void MempoolEvictionManySerial(benchmark::State& state)
+{
+    MempoolEvictionMany(state, false);
+}
+
+static void MempoolEvictionManyBatched(benchmark::State& state)
+{
+    MempoolEvictionMany(state, true);
+}
+
+BENCHMARK(MempoolEvictionManySerial, 20);
+BENCHMARK(MempoolEvictionManyBatched, 20);
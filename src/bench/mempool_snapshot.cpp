@@ -0,0 +1,59 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <policy/rbf.h>
+#include <random.h>
+#include <txmempool.h>
+
+#include <vector>
+
+static void AddTx(const CTransactionRef& tx, const CAmount& nFee, CTxMemPool& pool) EXCLUSIVE_LOCKS_REQUIRED(pool.cs)
+{
+    int64_t nTime = 0;
+    double dPriority = 10.0;
+    unsigned int nHeight = 1;
+    bool spendsCoinbase = false;
+    unsigned int sigOpCost = 4;
+    LockPoints lp;
+    pool.addUnchecked(tx->GetHash(), CTxMemPoolEntry(
+                                         tx, nFee, nTime, dPriority, nHeight,
+                                         tx->GetValueOut(), spendsCoinbase, sigOpCost, lp));
+}
+
+// Build the snapshot served to getrawmempool verbose and /rest/mempool/contents
+// from a full mempool of short chains, some of them signalling BIP125 at the
+// root. This is the time the rebuild holds the mempool lock for.
+static void MempoolSnapshot(benchmark::State& state)
+{
+    const int num_chains = 5000;
+    const int chain_length = 4;
+    FastRandomContext det_rand(true);
+    CTxMemPool pool;
+    LOCK(pool.cs);
+    for (int i = 0; i < num_chains; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << i << OP_1;
+        tx.vin[0].nSequence = det_rand.randbool() ? MAX_BIP125_RBF_SEQUENCE : CTxIn::SEQUENCE_FINAL;
+        tx.vout.resize(2);
+        tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[0].nValue = 10 * COIN;
+        tx.vout[1].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+        tx.vout[1].nValue = 10 * COIN;
+        for (int j = 0; j < chain_length; j++) {
+            AddTx(MakeTransactionRef(tx), 1000 + det_rand.randrange(100000), pool);
+            tx.vin[0].prevout = COutPoint(tx.GetHash(), 0);
+            tx.vin[0].scriptSig = CScript() << OP_2;
+            tx.vin[0].nSequence = CTxIn::SEQUENCE_FINAL;
+        }
+    }
+
+    while (state.KeepRunning()) {
+        CTxMemPoolSnapshot snapshot(pool);
+        assert(snapshot.GetEntries().size() == pool.size());
+    }
+}
+
+BENCHMARK(MempoolSnapshot, 10);
@@ -0,0 +1,84 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chainparams.h>
+#include <consensus/consensus.h>
+#include <hash.h>
+#include <net.h>
+#include <random.h>
+#include <streams.h>
+
+#include <list>
+#include <vector>
+
+// Parse a burst of transaction-relay traffic (alternating inv and tx
+// messages) the way the socket handler does, then drop the messages as the
+// message handler does once they have been processed.
+static void NetReceiveMessages(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const int num_messages = 1000;
+
+    FastRandomContext rng(true);
+    CDataStream stream(SER_NETWORK, INIT_PROTO_VERSION);
+    for (int i = 0; i < num_messages; i++) {
+        const bool is_inv = i % 2 == 0;
+        std::vector<unsigned char> payload(is_inv ? 37 : 200 + rng.randrange(400), (unsigned char)i);
+        CMessageHeader hdr(Params().MessageStart(), is_inv ? NetMsgType::INV : NetMsgType::TX, payload.size());
+        uint256 hash = Hash(payload.begin(), payload.end());
+        memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+        stream << hdr;
+        stream.write((const char*)payload.data(), payload.size());
+    }
+
+    while (state.KeepRunning()) {
+        std::list<CNetMessage> msgs;
+        const char* pch = stream.data();
+        unsigned int nBytes = stream.size();
+        while (nBytes > 0) {
+            if (msgs.empty() || msgs.back().complete())
+                msgs.emplace_back(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+            CNetMessage& msg = msgs.back();
+            int handled = msg.in_data ? msg.readData(pch, nBytes) : msg.readHeader(pch, nBytes);
+            assert(handled > 0);
+            pch += handled;
+            nBytes -= handled;
+        }
+        assert(msgs.size() == num_messages && msgs.back().complete());
+    }
+}
+
+// Receive one block-sized message whose payload trickles in a TCP segment at
+// a time, as it does from a peer on a slow or lossy link.
+static void NetReceiveLargeMessage(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const size_t segment_size = 1460;
+
+    std::vector<unsigned char> payload(MAX_BLOCK_SERIALIZED_SIZE, 0x42);
+    CMessageHeader hdr(Params().MessageStart(), NetMsgType::BLOCK, payload.size());
+    uint256 hash = Hash(payload.begin(), payload.end());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CDataStream stream(SER_NETWORK, INIT_PROTO_VERSION);
+    stream << hdr;
+    stream.write((const char*)payload.data(), payload.size());
+
+    while (state.KeepRunning()) {
+        CNetMessage msg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+        const char* pch = stream.data();
+        unsigned int nBytes = stream.size();
+        while (nBytes > 0) {
+            unsigned int nRead = std::min<unsigned int>(nBytes, segment_size);
+            int handled = msg.in_data ? msg.readData(pch, nRead) : msg.readHeader(pch, nRead);
+            assert(handled > 0);
+            pch += handled;
+            nBytes -= handled;
+        }
+        assert(msg.complete());
+    }
+}
+
+BENCHMARK(NetReceiveMessages, 100);
+BENCHMARK(NetReceiveLargeMessage, 10);
@@ -0,0 +1,58 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <key.h>
+#include <wallet/db.h>
+#include <wallet/wallet.h>
+#include <wallet/walletdb.h>
+
+#include <vector>
+
+static const int NUM_KEYS = 20000;
+
+// Import private keys into a wallet on a mock (in-memory) database, the way
+// importwallet and importmulti do: each key and its metadata are written
+// through a batch of their own. With a WalletBatchScope around the import,
+// the writes are committed a checkpoint at a time instead of one by one.
+static void WalletImportKeys(benchmark::State& state, bool scoped)
+{
+    std::vector<CKey> keys(NUM_KEYS);
+    std::vector<CPubKey> pubkeys;
+    for (CKey& key : keys) {
+        key.MakeNewKey(true);
+        pubkeys.push_back(key.GetPubKey());
+    }
+
+    while (state.KeepRunning()) {
+        // Keys can only be written once, so each run imports into a new wallet.
+        CWallet wallet("mock", WalletDatabase::CreateMock());
+        bool first_run;
+        wallet.LoadWallet(first_run);
+        LOCK(wallet.cs_wallet);
+
+        std::unique_ptr<WalletBatchScope> batch_scope;
+        if (scoped) {
+            batch_scope.reset(new WalletBatchScope(wallet.GetDBHandle()));
+        }
+        for (size_t i = 0; i < keys.size(); ++i) {
+            bool added = wallet.AddKeyPubKey(keys[i], pubkeys[i]);
+            assert(added);
+            if (batch_scope) {
+                bool written = batch_scope->Checkpoint();
+                assert(written);
+            }
+        }
+        if (batch_scope) {
+            bool written = batch_scope->Commit();
+            assert(written);
+        }
+    }
+}
+
+static void WalletImportKeysUnscoped(benchmark::State& state) { WalletImportKeys(state, false); }
+static void WalletImportKeysScoped(benchmark::State& state) { WalletImportKeys(state, true); }
+
+BENCHMARK(WalletImportKeysUnscoped, 1);
+BENCHMARK(WalletImportKeysScoped, 1);
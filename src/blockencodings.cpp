@@ -15,6 +15,11 @@
 
 #include <unordered_map>
 
+//! Number of mempool short IDs computed at once in PartiallyDownloadedBlock::InitData
+static const size_t SHORTID_BATCH_SIZE = 64;
+//! Size in bits of the bitmap used to prefilter mempool short IDs (8 KiB, fits in L1)
+static const uint64_t SHORTID_FILTER_SIZE = 1 << 16;
+
 CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID) :
         nonce(GetRand(std::numeric_limits<uint64_t>::max())),
         shorttxids(block.vtx.size() - 1), prefilledtxn(1), header(block) {
@@ -101,16 +106,31 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     if (shorttxids.size() != cmpctblock.shorttxids.size())
         return READ_STATUS_FAILED; // Short ID collision
 
+    // Short IDs are keyed per block, so they cannot be indexed ahead of time;
+    // instead the mempool's witness hashes are hashed in batches, and a small
+    // bitmap over the low bits of our short IDs filters out nearly all
+    // non-matching mempool transactions before the hash map is consulted.
+    std::vector<bool> shortid_filter(SHORTID_FILTER_SIZE);
+    for (const uint64_t shortid : cmpctblock.shorttxids) {
+        shortid_filter[shortid % SHORTID_FILTER_SIZE] = true;
+    }
+
     std::vector<bool> have_txn(txn_available.size());
     {
     LOCK(pool->cs);
-    const std::vector<std::pair<uint256, CTxMemPool::txiter> >& vTxHashes = pool->vTxHashes;
+    const std::vector<uint256>& vTxHashes = pool->vTxHashes;
+    uint64_t shortids[SHORTID_BATCH_SIZE];
     for (size_t i = 0; i < vTxHashes.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
+        if (i % SHORTID_BATCH_SIZE == 0) {
+            SipHashUint256Many(cmpctblock.shorttxidk0, cmpctblock.shorttxidk1, &vTxHashes[i], std::min(SHORTID_BATCH_SIZE, vTxHashes.size() - i), shortids);
+        }
+        uint64_t shortid = shortids[i % SHORTID_BATCH_SIZE] & 0xffffffffffffL;
+        if (!shortid_filter[shortid % SHORTID_FILTER_SIZE])
+            continue;
         std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
         if (idit != shorttxids.end()) {
             if (!have_txn[idit->second]) {
-                txn_available[idit->second] = vTxHashes[i].second->GetSharedTx();
+                txn_available[idit->second] = pool->vTxHashesEntries[i]->GetSharedTx();
                 have_txn[idit->second]  = true;
                 mempool_count++;
             } else {
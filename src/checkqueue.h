@@ -52,6 +52,10 @@ private:
     //! The temporary evaluation result.
     bool fAllOk;
 
+    //! The first check that failed, if any (see fHaveFailure).
+    T failure;
+    bool fHaveFailure;
+
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
@@ -63,19 +67,26 @@ private:
     unsigned int nBatchSize;
 
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(bool fMaster = false, T* pfailure = nullptr)
     {
         boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
         unsigned int nNow = 0;
         bool fOk = true;
+        T failed;
+        bool fFailed = false;
         do {
             {
                 boost::unique_lock<boost::mutex> lock(mutex);
                 // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
                 if (nNow) {
                     fAllOk &= fOk;
+                    if (fFailed && !fHaveFailure) {
+                        failure.swap(failed);
+                        fHaveFailure = true;
+                    }
+                    fFailed = false;
                     nTodo -= nNow;
                     if (nTodo == 0 && !fMaster)
                         // We processed the last element; inform the master it can exit and return the result
@@ -89,9 +100,14 @@ private:
                     if (fMaster && nTodo == 0) {
                         nTotal--;
                         bool fRet = fAllOk;
+                        if (pfailure && fHaveFailure)
+                            pfailure->swap(failure);
                         // reset the status for new work later
-                        if (fMaster)
+                        if (fMaster) {
                             fAllOk = true;
+                            T().swap(failure);
+                            fHaveFailure = false;
+                        }
                         // return the current status
                         return fRet;
                     }
@@ -116,9 +132,16 @@ private:
                 fOk = fAllOk;
             }
             // execute work
-            for (T& check : vChecks)
-                if (fOk)
+            for (T& check : vChecks) {
+                if (fOk) {
                     fOk = check();
+                    if (!fOk) {
+                        // Keep it, so the master can tell which one failed
+                        failed.swap(check);
+                        fFailed = true;
+                    }
+                }
+            }
             vChecks.clear();
         } while (true);
     }
@@ -128,7 +151,7 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    explicit CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn) {}
+    explicit CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), fHaveFailure(false), nTodo(0), nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
@@ -137,9 +160,10 @@ public:
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
-    bool Wait()
+    //! If not, and pfailure is given, it is swapped with (one of) the checks that failed.
+    bool Wait(T* pfailure = nullptr)
     {
-        return Loop(true);
+        return Loop(true, pfailure);
     }
 
     //! Add a batch of checks to the queue
@@ -186,11 +210,11 @@ public:
         }
     }
 
-    bool Wait()
+    bool Wait(T* pfailure = nullptr)
     {
         if (pqueue == nullptr)
             return true;
-        bool fRet = pqueue->Wait();
+        bool fRet = pqueue->Wait(pfailure);
         fDone = true;
         return fRet;
     }
@@ -95,8 +95,17 @@ typedef void* sockopt_arg_type;
 typedef char* sockopt_arg_type;
 #endif
 
+// poll() is broken on Windows (WSAPoll) and macOS, so those keep using select().
+// Linux uses epoll for the socket handler and poll() for single sockets.
+#if !defined(WIN32) && !defined(__APPLE__)
+#define USE_POLL
+#endif
+#if defined(__linux__)
+#define USE_EPOLL
+#endif
+
 bool static inline IsSelectableSocket(const SOCKET& s) {
-#ifdef WIN32
+#if defined(USE_POLL) || defined(WIN32)
     return true;
 #else
     return (s < FD_SETSIZE);
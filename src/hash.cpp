@@ -6,6 +6,13 @@
 #include <crypto/common.h>
 #include <crypto/hmac_sha512.h>
 
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+namespace siphash_avx2
+{
+void SipHash32_4way(uint64_t k0, uint64_t k1, const unsigned char* in, uint64_t* out);
+}
+#endif
+
 
 inline uint32_t ROTL32(uint32_t x, int8_t r)
 {
@@ -245,3 +252,20 @@ uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint3
     SIPROUND;
     return v0 ^ v1 ^ v2 ^ v3;
 }
+
+void SipHashUint256Many(uint64_t k0, uint64_t k1, const uint256* vals, size_t count, uint64_t* out)
+{
+    static_assert(sizeof(uint256) == 32, "SipHash32_4way assumes tightly packed uint256 arrays");
+    size_t i = 0;
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL) && defined(__GNUC__)
+    static const bool use_avx2 = __builtin_cpu_supports("avx2");
+    if (use_avx2) {
+        for (; i + 4 <= count; i += 4) {
+            siphash_avx2::SipHash32_4way(k0, k1, vals[i].begin(), out + i);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] = SipHashUint256(k0, k1, vals[i]);
+    }
+}
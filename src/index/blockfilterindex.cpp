@@ -0,0 +1,94 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coins.h>
+#include <index/blockfilterindex.h>
+#include <undo.h>
+#include <util.h>
+#include <validation.h>
+
+constexpr char DB_FILTER = 'f';
+
+std::unique_ptr<BlockFilterIndex> g_blockfilterindex;
+
+/**
+ * Access to the blockfilter database (indexes/blockfilter/<type>/)
+ *
+ * The database stores a block locator of the chain the database is synced to
+ * so that the BlockFilterIndex can efficiently determine the point it last
+ * stopped at, and the encoded filter of each indexed block keyed by its hash.
+ */
+class BlockFilterIndex::DB : public BaseIndex::DB
+{
+public:
+    explicit DB(const fs::path& path, size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    /// Read the encoded filter of the block with the given hash. Returns false if the block is
+    /// not indexed.
+    bool ReadFilter(const uint256& block_hash, std::vector<unsigned char>& encoded_filter) const;
+
+    /// Write the encoded filter of a block to the DB.
+    bool WriteFilter(const uint256& block_hash, const std::vector<unsigned char>& encoded_filter);
+};
+
+BlockFilterIndex::DB::DB(const fs::path& path, size_t n_cache_size, bool f_memory, bool f_wipe) :
+    BaseIndex::DB(path, n_cache_size, f_memory, f_wipe)
+{}
+
+bool BlockFilterIndex::DB::ReadFilter(const uint256& block_hash, std::vector<unsigned char>& encoded_filter) const
+{
+    return Read(std::make_pair(DB_FILTER, block_hash), encoded_filter);
+}
+
+bool BlockFilterIndex::DB::WriteFilter(const uint256& block_hash, const std::vector<unsigned char>& encoded_filter)
+{
+    return Write(std::make_pair(DB_FILTER, block_hash), encoded_filter);
+}
+
+static const char* BlockFilterTypeName(BlockFilterType filter_type)
+{
+    switch (filter_type) {
+    case BlockFilterType::BASIC: return "basic";
+    }
+    return "unknown";
+}
+
+BlockFilterIndex::BlockFilterIndex(BlockFilterType filter_type,
+                                   size_t n_cache_size, bool f_memory, bool f_wipe)
+    : m_filter_type(filter_type),
+      m_db(MakeUnique<BlockFilterIndex::DB>(GetDataDir() / "indexes" / "blockfilter" / BlockFilterTypeName(filter_type),
+                                            n_cache_size, f_memory, f_wipe))
+{}
+
+BlockFilterIndex::~BlockFilterIndex() {}
+
+bool BlockFilterIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    CBlockUndo block_undo;
+    if (pindex->nHeight > 0) {
+        if (!UndoReadFromDisk(block_undo, pindex)) {
+            return false;
+        }
+    }
+
+    BlockFilter filter(m_filter_type, block, block_undo);
+    return m_db->WriteFilter(pindex->GetBlockHash(), filter.GetEncodedFilter());
+}
+
+BaseIndex::DB& BlockFilterIndex::GetDB() const { return *m_db; }
+
+bool BlockFilterIndex::LookupFilter(const CBlockIndex* block_index, BlockFilter& filter_out) const
+{
+    std::vector<unsigned char> encoded_filter;
+    if (!m_db->ReadFilter(block_index->GetBlockHash(), encoded_filter)) {
+        return false;
+    }
+
+    try {
+        filter_out = BlockFilter(m_filter_type, block_index->GetBlockHash(), std::move(encoded_filter));
+    } catch (const std::exception& e) {
+        return error("%s: Invalid filter for block %s - %s", __func__, block_index->GetBlockHash().ToString(), e.what());
+    }
+    return true;
+}
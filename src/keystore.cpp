@@ -5,10 +5,23 @@
 
 #include <keystore.h>
 
+#include <random.h>
 #include <util.h>
 
 bool g_implicit_segwit = true;
 
+SaltedScriptHasher::SaltedScriptHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+void CBasicKeyStore::AddIsMineScript(const CScript& script)
+{
+    AssertLockHeld(cs_KeyStore);
+    auto inserted = m_ismine_scripts.emplace(script, CachedIsMine{ISMINE_NO, 0});
+    if (inserted.second) {
+        m_ismine_scripts_order.push_back(&inserted.first->first);
+    }
+    ++m_ismine_generation;
+}
+
 void CBasicKeyStore::ImplicitlyLearnRelatedKeyScripts(const CPubKey& pubkey)
 {
     AssertLockHeld(cs_KeyStore);
@@ -32,6 +45,16 @@ void CBasicKeyStore::ImplicitlyLearnRelatedKeyScripts(const CPubKey& pubkey)
         CScriptID id(script);
         mapScripts[id] = std::move(script);
     }
+
+    // Index the scripts paying to this key in every form IsMine might accept,
+    // whether or not segwit scripts are implicitly learned for it.
+    AddIsMineScript(GetScriptForRawPubKey(pubkey));
+    AddIsMineScript(GetScriptForDestination(key_id));
+    if (pubkey.IsCompressed()) {
+        CScript witness_program = GetScriptForDestination(WitnessV0KeyHash(key_id));
+        AddIsMineScript(GetScriptForDestination(CScriptID(witness_program)));
+        AddIsMineScript(witness_program);
+    }
 }
 
 bool CBasicKeyStore::GetPubKey(const CKeyID &address, CPubKey &vchPubKeyOut) const
@@ -92,6 +115,8 @@ bool CBasicKeyStore::AddCScript(const CScript& redeemScript)
 
     LOCK(cs_KeyStore);
     mapScripts[CScriptID(redeemScript)] = redeemScript;
+    AddIsMineScript(GetScriptForDestination(CScriptID(redeemScript)));
+    AddIsMineScript(GetScriptForDestination(WitnessV0ScriptHash(redeemScript)));
     return true;
 }
 
@@ -143,6 +168,7 @@ bool CBasicKeyStore::AddWatchOnly(const CScript &dest)
 {
     LOCK(cs_KeyStore);
     setWatchOnly.insert(dest);
+    AddIsMineScript(dest);
     CPubKey pubKey;
     if (ExtractPubKey(dest, pubKey)) {
         mapWatchKeys[pubKey.GetID()] = pubKey;
@@ -155,6 +181,7 @@ bool CBasicKeyStore::RemoveWatchOnly(const CScript &dest)
 {
     LOCK(cs_KeyStore);
     setWatchOnly.erase(dest);
+    ++m_ismine_generation;
     CPubKey pubKey;
     if (ExtractPubKey(dest, pubKey)) {
         mapWatchKeys.erase(pubKey.GetID());
@@ -176,6 +203,21 @@ bool CBasicKeyStore::HaveWatchOnly() const
     return (!setWatchOnly.empty());
 }
 
+isminetype CBasicKeyStore::IsMineIndexed(const CScript& script) const
+{
+    LOCK(cs_KeyStore);
+    auto it = m_ismine_scripts.find(script);
+    if (it == m_ismine_scripts.end()) {
+        return ISMINE_NO;
+    }
+    CachedIsMine& cached = it->second;
+    if (cached.generation != m_ismine_generation) {
+        cached.type = ::IsMine(*this, script);
+        cached.generation = m_ismine_generation;
+    }
+    return cached.type;
+}
+
 CKeyID GetKeyForDestination(const CKeyStore& store, const CTxDestination& dest)
 {
     // Only supports destinations which map to single public keys, i.e. P2PKH,
@@ -204,3 +246,4 @@ bool HaveKey(const CKeyStore& store, const CKey& key)
     key2.Set(key.begin(), key.end(), !key.IsCompressed());
     return store.HaveKey(key.GetPubKey().GetID()) || store.HaveKey(key2.GetPubKey().GetID());
 }
+
@@ -6,13 +6,17 @@
 #ifndef BITCOIN_KEYSTORE_H
 #define BITCOIN_KEYSTORE_H
 
+#include <hash.h>
 #include <key.h>
 #include <pubkey.h>
+#include <script/ismine.h>
 #include <script/script.h>
 #include <script/sign.h>
 #include <script/standard.h>
 #include <sync.h>
 
+#include <unordered_map>
+
 #include <boost/signals2/signal.hpp>
 
 static const bool DEFAULT_WALLET_IMPLICIT_SEGWIT = false;
@@ -42,6 +46,21 @@ public:
     virtual bool HaveWatchOnly() const =0;
 };
 
+/** Salted hasher for using scripts as keys of hashed containers */
+class SaltedScriptHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    SaltedScriptHasher();
+
+    size_t operator()(const CScript& script) const {
+        return CSipHasher(k0, k1).Write(script.data(), script.size()).Finalize();
+    }
+};
+
 /** Basic key store, that keeps keys in an address->secret map */
 class CBasicKeyStore : public CKeyStore
 {
@@ -60,6 +79,25 @@ protected:
 
     void ImplicitlyLearnRelatedKeyScripts(const CPubKey& pubkey) EXCLUSIVE_LOCKS_REQUIRED(cs_KeyStore);
 
+    struct CachedIsMine {
+        isminetype type;
+        //! Value of m_ismine_generation when type was computed
+        uint64_t generation;
+    };
+
+    /**
+     * Index of every scriptPubKey IsMine could accept given the keys, scripts and
+     * watch-only scripts in the store, with the last IsMine result for each. A
+     * script missing from it is not ours, so such lookups take a single hash probe.
+     */
+    mutable std::unordered_map<CScript, CachedIsMine, SaltedScriptHasher> m_ismine_scripts GUARDED_BY(cs_KeyStore);
+    //! The keys of m_ismine_scripts, in the order they were added. Scripts are never removed from it.
+    std::vector<const CScript*> m_ismine_scripts_order GUARDED_BY(cs_KeyStore);
+    //! Bumped on every change to the store, invalidating all cached IsMine results
+    uint64_t m_ismine_generation GUARDED_BY(cs_KeyStore) = 1;
+
+    void AddIsMineScript(const CScript& script) EXCLUSIVE_LOCKS_REQUIRED(cs_KeyStore);
+
 public:
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey) override;
     bool AddKey(const CKey &key) { return AddKeyPubKey(key, key.GetPubKey()); }
@@ -76,6 +114,9 @@ public:
     bool RemoveWatchOnly(const CScript &dest) override;
     bool HaveWatchOnly(const CScript &dest) const override;
     bool HaveWatchOnly() const override;
+
+    /** Same as IsMine(*this, script), answered from the index of this store's scripts. */
+    isminetype IsMineIndexed(const CScript& script) const;
 };
 
 /** Return the CKeyID of the key involved in a script (if there is a unique one). */
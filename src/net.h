@@ -27,6 +27,7 @@
 #include <stdint.h>
 #include <thread>
 #include <memory>
+#include <mutex>
 #include <condition_variable>
 
 #ifndef WIN32
@@ -81,6 +82,10 @@ static const bool DEFAULT_BLOCKSONLY = false;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** Default number of message handler threads; peers are spread over them by node id */
+static const int DEFAULT_MSGHAND_THREADS = 1;
+/** Maximum number of message handler threads */
+static const int MAX_MSGHAND_THREADS = 16;
 
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h")
 static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 60 * 24;  // Default 24-hour ban
@@ -111,6 +116,22 @@ struct CSerializedNetMsg
     std::string command;
 };
 
+/** Immutable, reference counted buffer queued for sending to a peer */
+typedef std::shared_ptr<const std::vector<unsigned char>> CSendBufferRef;
+
+/**
+ * A serialized network message whose header and payload are built once and
+ * shared, so the same message can be queued to many peers without copying.
+ */
+struct CSharedNetMsg
+{
+    explicit CSharedNetMsg(CSerializedNetMsg&& msg);
+
+    CSendBufferRef header;
+    CSendBufferRef data;
+    std::string command;
+};
+
 class NetEventsInterface;
 class CConnman
 {
@@ -135,6 +156,7 @@ public:
         NetEventsInterface* m_msgproc = nullptr;
         unsigned int nSendBufferMaxSize = 0;
         unsigned int nReceiveFloodSize = 0;
+        int nMsgHandThreads = DEFAULT_MSGHAND_THREADS;
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
         std::vector<std::string> vSeedNodes;
@@ -156,6 +178,7 @@ public:
         m_msgproc = connOptions.m_msgproc;
         nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
         nReceiveFloodSize = connOptions.nReceiveFloodSize;
+        nMsgHandThreads = std::max(1, std::min(connOptions.nMsgHandThreads, MAX_MSGHAND_THREADS));
         {
             LOCK(cs_totalBytesSent);
             nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
@@ -181,6 +204,7 @@ public:
     bool ForNode(NodeId id, std::function<bool(CNode* pnode)> func);
 
     void PushMessage(CNode* pnode, CSerializedNetMsg&& msg);
+    void PushMessage(CNode* pnode, const CSharedNetMsg& msg);
 
     template<typename Callable>
     void ForEachNode(Callable&& func)
@@ -312,6 +336,8 @@ public:
     unsigned int GetReceiveFloodSize() const;
 
     void WakeMessageHandler();
+    /** Wake only the message handler thread that serves the given peer */
+    void WakeMessageHandler(NodeId id);
 
     /** Attempts to obfuscate tx time through exponentially distributed emitting.
         Works assuming that a single interval is used.
@@ -334,8 +360,14 @@ private:
     void AddOneShot(const std::string& strDest);
     void ProcessOneShot();
     void ThreadOpenConnections(std::vector<std::string> connect);
-    void ThreadMessageHandler();
+    void ThreadMessageHandler(int shard);
     void AcceptConnection(const ListenSocket& hListenSocket);
+    void DisconnectNodes();
+    void NotifyNumConnectionsChanged();
+    void InactivityCheck(CNode *pnode);
+    bool GenerateSelectSet(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
+    void SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
+    void SocketHandler();
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
 
@@ -355,6 +387,7 @@ private:
     NodeId GetNewNodeId();
 
     size_t SocketSendData(CNode *pnode) const;
+    void PushMessageBuffers(CNode* pnode, const std::string& command, CSendBufferRef header, CSendBufferRef data);
     //!check is the banlist has unwritten changes
     bool BannedSetIsDirty();
     //!set the "dirty" flag for the banlist
@@ -390,6 +423,7 @@ private:
 
     unsigned int nSendBufferMaxSize;
     unsigned int nReceiveFloodSize;
+    int nMsgHandThreads;
 
     std::vector<ListenSocket> vhListenSocket;
     std::atomic<bool> fNetworkActive;
@@ -405,6 +439,7 @@ private:
     std::vector<CNode*> vNodes;
     std::list<CNode*> vNodesDisconnected;
     mutable CCriticalSection cs_vNodes;
+    unsigned int nPrevNodeCount = 0; //!< Only used by the socket handler thread
     std::atomic<NodeId> nLastNodeId;
 
     /** Services this instance offers */
@@ -423,8 +458,8 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake;
+    /** flags for waking the message processor, one per handler thread. */
+    std::vector<bool> vMsgProcWake;
 
     std::condition_variable condMsgProc;
     std::mutex mutexMsgProc;
@@ -432,11 +467,16 @@ private:
 
     CThreadInterrupt interruptNet;
 
+#ifdef USE_EPOLL
+    /** epoll instance the socket handler waits on; created on first use */
+    int m_epoll_fd = -1;
+#endif
+
     std::thread threadDNSAddressSeed;
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> threadMessageHandlers;
 
     /** flag for deciding to connect to an extra outbound peer,
      *  in excess of nMaxOutbound
@@ -570,10 +610,51 @@ public:
 
 
 
+/**
+ * Recycles receive buffers between messages. Idle buffers are kept in
+ * power-of-two size classes; a message's payload buffer is sized from its
+ * header and handed back once the message has been processed.
+ */
+class CNetMessageBufferPool
+{
+public:
+    /** Smallest (2^8 bytes) and largest (2^20 bytes) size class kept in the pool */
+    static const unsigned int MIN_SIZE_CLASS = 8;
+    static const unsigned int MAX_SIZE_CLASS = 20;
+    /** Upper bound on the memory held by idle buffers */
+    static const size_t MAX_POOLED_BYTES = 8 * 1024 * 1024;
+
+    struct Stats
+    {
+        uint64_t nAllocated = 0; // buffers that had to be freshly allocated
+        uint64_t nReused = 0;    // buffers taken from the pool
+    };
+
+    CNetMessageBufferPool();
+
+    /** Return an empty buffer with room for at least nSize bytes, counted against command if given */
+    CSerializeData Get(size_t nSize, const char* command = nullptr);
+    /** Hand back a buffer that is no longer needed */
+    void Put(CSerializeData&& buf);
+
+    size_t GetPooledBytes() const;
+    std::map<std::string, Stats> GetStats() const;
+
+private:
+    void InitStats() const;
+
+    mutable std::mutex m_mutex;
+    std::vector<std::vector<CSerializeData>> m_free;
+    size_t m_pooled_bytes;
+    mutable std::map<std::string, Stats> m_stats;
+};
+
+extern CNetMessageBufferPool g_recv_buffer_pool;
+
 class CNetMessage {
 private:
-    mutable CHash256 hasher;
-    mutable uint256 data_hash;
+    CHash256 hasher;                // checksum of the payload, fed as it arrives
+    uint256 data_hash;
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
@@ -587,12 +668,16 @@ public:
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
     CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
+        CSerializeData buf = g_recv_buffer_pool.Get(24);
+        hdrbuf.SwapBuffer(buf);
         hdrbuf.resize(24);
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
     }
+    CNetMessage(CNetMessage&&) = default;
+    ~CNetMessage();
 
     bool complete() const
     {
@@ -601,6 +686,8 @@ public:
         return (hdr.nMessageSize == nDataPos);
     }
 
+    /** Finish the checksum of a complete message; true if it matches the header */
+    bool VerifyChecksum();
     const uint256& GetMessageHash() const;
 
     void SetVersion(int nVersionIn)
@@ -625,7 +712,7 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    std::deque<CSendBufferRef> vSendMsg;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -678,6 +765,12 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+#ifdef USE_EPOLL
+    // Registration of hSocket with CConnman's epoll instance; only used by
+    // the socket handler thread.
+    bool m_epoll_registered{false};
+    uint32_t m_epoll_events{0};
+#endif
 protected:
 
     mapMsgCmdSize mapSendBytesPerMsgCmd;
@@ -688,8 +781,10 @@ public:
     std::atomic<int> nStartingHeight;
 
     // flood relay
-    std::vector<CAddress> vAddrToSend;
-    CRollingBloomFilter addrKnown;
+    // Other peers' message handler threads may push addresses to us
+    CCriticalSection cs_addrSend;
+    std::vector<CAddress> vAddrToSend GUARDED_BY(cs_addrSend);
+    CRollingBloomFilter addrKnown GUARDED_BY(cs_addrSend);
     bool fGetAddr;
     std::set<uint256> setKnown;
     int64_t nNextAddrSend;
@@ -810,11 +905,13 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_addrSend);
         addrKnown.insert(_addr.GetKey());
     }
 
     void PushAddress(const CAddress& _addr, FastRandomContext &insecure_rand)
     {
+        LOCK(cs_addrSend);
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
@@ -32,6 +32,8 @@
 
 #include <memory>
 
+#include <boost/bind.hpp>
+
 #if defined(NDEBUG)
 # error "Bitcoin cannot be compiled without assertions."
 #endif
@@ -153,8 +155,40 @@ namespace {
     /** When our tip was last updated. */
     std::atomic<int64_t> g_last_tip_update(0);
 
+    /**
+     * Serialized network messages for an object relayed to many peers. Each
+     * encoding (with or without witness) is serialized and checksummed once,
+     * on first request, and then shared by every peer it is sent to.
+     */
+    class RelayMessageCache
+    {
+    public:
+        template <typename T>
+        std::shared_ptr<const CSharedNetMsg> Get(const std::string& command, bool fWitness, const T& obj)
+        {
+            LOCK(cs);
+            std::shared_ptr<const CSharedNetMsg>& msg = fWitness ? msg_witness : msg_no_witness;
+            if (!msg) {
+                msg = std::make_shared<const CSharedNetMsg>(CNetMsgMaker(PROTOCOL_VERSION).Make(fWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, command, obj));
+            }
+            return msg;
+        }
+
+    private:
+        CCriticalSection cs;
+        std::shared_ptr<const CSharedNetMsg> msg_witness GUARDED_BY(cs);
+        std::shared_ptr<const CSharedNetMsg> msg_no_witness GUARDED_BY(cs);
+    };
+
+    struct RelayTx
+    {
+        explicit RelayTx(CTransactionRef txIn) : tx(std::move(txIn)) {}
+        CTransactionRef tx;
+        RelayMessageCache msgs;
+    };
+
     /** Relay map */
-    typedef std::map<uint256, CTransactionRef> MapRelay;
+    typedef std::map<uint256, RelayTx> MapRelay;
     MapRelay mapRelay GUARDED_BY(cs_main);
     /** Expiration-time ordered list of (expire time, relay map entry) pairs. */
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration GUARDED_BY(cs_main);
@@ -222,6 +256,10 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! Moving average of the time (in microseconds) this peer took to deliver each requested block, or 0 if unknown.
+    int64_t m_block_download_time;
+    //! Moving average of the size (in bytes) of the blocks this peer delivered.
+    int64_t m_block_download_size;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
@@ -289,6 +327,8 @@ struct CNodeState {
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        m_block_download_time = 0;
+        m_block_download_size = 0;
         fPreferredDownload = false;
         fPreferHeaders = false;
         fPreferHeaderAndIDs = false;
@@ -367,6 +407,39 @@ static bool MarkBlockAsReceived(const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs
     return false;
 }
 
+/** Update a peer's download speed estimate on receipt of a block of nSize bytes that
+ *  we requested from it. Must be called before MarkBlockAsReceived. */
+static void UpdateBlockDownloadStats(NodeId nodeid, const uint256& hash, size_t nSize) EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeid)
+        return;
+    CNodeState *state = State(nodeid);
+    assert(state != nullptr);
+    // Peers serve getdata requests in order, so only the head of the queue gives
+    // a clean measurement: the time since the previous block arrived (or since
+    // the request was sent, if the peer was idle) is what this one took.
+    if (state->vBlocksInFlight.begin() != itInFlight->second.second)
+        return;
+    const int64_t nTime = std::max<int64_t>(GetTimeMicros() - state->nDownloadingSince, 1);
+    if (state->m_block_download_time == 0) {
+        state->m_block_download_time = nTime;
+        state->m_block_download_size = nSize;
+    } else {
+        state->m_block_download_time += (nTime - state->m_block_download_time) / 8;
+        state->m_block_download_size += ((int64_t)nSize - state->m_block_download_size) / 8;
+    }
+}
+
+/** Number of blocks we are willing to have in flight from a peer: enough to keep it
+ *  busy for BLOCK_DOWNLOAD_TARGET_QUEUE_TIME, so that slow peers hold back fewer
+ *  blocks of the download window and fast peers are kept saturated. */
+static int GetBlocksInFlightLimit(const CNodeState& state) {
+    if (state.m_block_download_time == 0)
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    int64_t limit = BLOCK_DOWNLOAD_TARGET_QUEUE_TIME / state.m_block_download_time;
+    return std::max<int64_t>(MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(limit, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER));
+}
+
 // returns false, still setting pit, if the block was already in flight from the same peer
 // pit will only be valid as long as the same cs_main lock is being held
 static bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const CBlockIndex* pindex = nullptr, std::list<QueuedBlock>::iterator** pit = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
@@ -503,8 +576,9 @@ static bool PeerHasHeader(CNodeState *state, const CBlockIndex *pindex) EXCLUSIV
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
-static void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const Consensus::Params& consensusParams) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+ *  at most count entries. If nothing can be fetched because the download window is held back by
+ *  a block in flight from another peer, set nodeStaller and pindexStalled to that peer and block. */
+static void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const CBlockIndex*& pindexStalled, const Consensus::Params& consensusParams) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     if (count == 0)
         return;
@@ -541,6 +615,7 @@ static void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vec
     int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    const CBlockIndex* pindexWaitingFor = nullptr;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -576,6 +651,7 @@ static void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vec
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
                         nodeStaller = waitingfor;
+                        pindexStalled = pindexWaitingFor;
                     }
                     return;
                 }
@@ -586,6 +662,7 @@ static void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vec
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaitingFor = pindex;
             }
         }
     }
@@ -668,6 +745,9 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.m_block_download_time = state->m_block_download_time;
+    stats.m_block_download_rate = state->m_block_download_time ? state->m_block_download_size * 1000000 / state->m_block_download_time : 0;
+    stats.m_blocks_in_flight_limit = GetBlocksInFlightLimit(*state);
     return true;
 }
 
@@ -841,12 +921,102 @@ static bool BlockRequestAllowed(const CBlockIndex* pindex, const Consensus::Para
         (GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, consensusParams) < STALE_RELAY_AGE_LIMIT);
 }
 
+namespace {
+/** How long looked-up mempool data for relay candidates may be reused */
+static const int64_t TX_RELAY_CACHE_REFRESH = 1 * 1000000;
+/** How often stale entries are dropped from the relay cache */
+static const int64_t TX_RELAY_CACHE_PRUNE_INTERVAL = 60 * 1000000;
+
+/**
+ * Mempool data for the transactions being announced, shared by all peers.
+ * Peers trickle at the same moments (inbound peers share a single timer),
+ * so the first one to trickle looks the candidates up in the mempool under
+ * one lock, and the others order and filter their queues from this cache
+ * without touching the mempool. Cached entries are dropped as soon as their
+ * transaction enters or leaves the mempool, so only the ordering data
+ * (ancestor count) can be up to TX_RELAY_CACHE_REFRESH old.
+ */
+class TxRelayCache
+{
+public:
+    struct Entry
+    {
+        TxMempoolInfo info; //!< null tx if not in the mempool
+        int64_t nTimeFetched;
+    };
+    typedef std::shared_ptr<const Entry> EntryRef;
+
+    std::vector<EntryRef> Get(const std::vector<uint256>& hashes, int64_t nNow)
+    {
+        std::vector<EntryRef> ret(hashes.size());
+        std::vector<size_t> missing;
+        {
+            LOCK(cs);
+            if (m_next_prune < nNow) {
+                for (auto it = m_entries.begin(); it != m_entries.end();) {
+                    if (it->second->nTimeFetched + TX_RELAY_CACHE_REFRESH < nNow)
+                        it = m_entries.erase(it);
+                    else
+                        ++it;
+                }
+                m_next_prune = nNow + TX_RELAY_CACHE_PRUNE_INTERVAL;
+            }
+            for (size_t i = 0; i < hashes.size(); i++) {
+                auto it = m_entries.find(hashes[i]);
+                if (it != m_entries.end() && it->second->nTimeFetched + TX_RELAY_CACHE_REFRESH >= nNow)
+                    ret[i] = it->second;
+                else
+                    missing.push_back(i);
+            }
+        }
+        if (!missing.empty()) {
+            std::vector<uint256> vMissing;
+            vMissing.reserve(missing.size());
+            for (size_t i : missing)
+                vMissing.push_back(hashes[i]);
+            // The mempool notifies additions and removals with mempool.cs held, so
+            // holding it until the results are cached keeps them from going stale.
+            LOCK2(mempool.cs, cs);
+            std::vector<TxMempoolInfo> infos = mempool.info(vMissing);
+            for (size_t j = 0; j < missing.size(); j++) {
+                EntryRef entry = std::make_shared<const Entry>(Entry{std::move(infos[j]), nNow});
+                m_entries[vMissing[j]] = entry;
+                ret[missing[j]] = std::move(entry);
+            }
+        }
+        return ret;
+    }
+
+    /** Drop what was cached for a transaction that entered or left the mempool. */
+    void TransactionAdded(CTransactionRef tx)
+    {
+        LOCK(cs);
+        m_entries.erase(tx->GetHash());
+    }
+
+    void TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason)
+    {
+        TransactionAdded(tx);
+    }
+
+private:
+    CCriticalSection cs;
+    std::unordered_map<uint256, EntryRef, SaltedTxidHasher> m_entries GUARDED_BY(cs);
+    int64_t m_next_prune GUARDED_BY(cs) = 0;
+};
+
+TxRelayCache g_tx_relay_cache;
+} // namespace
+
 PeerLogicValidation::PeerLogicValidation(CConnman* connmanIn, CScheduler &scheduler, bool enable_bip61)
     : connman(connmanIn), m_stale_tip_check_time(0), m_enable_bip61(enable_bip61) {
 
     // Initialize global variables that cannot be constructed at startup.
     recentRejects.reset(new CRollingBloomFilter(120000, 0.000001));
 
+    mempool.NotifyEntryAdded.connect(boost::bind(&TxRelayCache::TransactionAdded, &g_tx_relay_cache, _1));
+    mempool.NotifyEntryRemoved.connect(boost::bind(&TxRelayCache::TransactionRemoved, &g_tx_relay_cache, _1, _2));
+
     const Consensus::Params& consensusParams = Params().GetConsensus();
     // Stale tip checking and peer eviction are on two different timers, but we
     // don't want them to get out of sync due to drift in the scheduler, so we
@@ -856,6 +1026,12 @@ PeerLogicValidation::PeerLogicValidation(CConnman* connmanIn, CScheduler &schedu
     scheduler.scheduleEvery(std::bind(&PeerLogicValidation::CheckForStaleTipAndEvictPeers, this, consensusParams), EXTRA_PEER_CHECK_INTERVAL * 1000);
 }
 
+PeerLogicValidation::~PeerLogicValidation()
+{
+    mempool.NotifyEntryAdded.disconnect(boost::bind(&TxRelayCache::TransactionAdded, &g_tx_relay_cache, _1));
+    mempool.NotifyEntryRemoved.disconnect(boost::bind(&TxRelayCache::TransactionRemoved, &g_tx_relay_cache, _1, _2));
+}
+
 /**
  * Evict orphan txn pool entries (EraseOrphanTx) based on a newly connected
  * block. Also save the time of the last tip update.
@@ -896,6 +1072,8 @@ void PeerLogicValidation::BlockConnected(const std::shared_ptr<const CBlock>& pb
 static CCriticalSection cs_most_recent_block;
 static std::shared_ptr<const CBlock> most_recent_block GUARDED_BY(cs_most_recent_block);
 static std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_block GUARDED_BY(cs_most_recent_block);
+static std::shared_ptr<RelayMessageCache> most_recent_block_msgs GUARDED_BY(cs_most_recent_block);
+static std::shared_ptr<RelayMessageCache> most_recent_compact_block_msgs GUARDED_BY(cs_most_recent_block);
 static uint256 most_recent_block_hash GUARDED_BY(cs_most_recent_block);
 static bool fWitnessesPresentInMostRecentCompactBlock GUARDED_BY(cs_most_recent_block);
 
@@ -905,7 +1083,7 @@ static bool fWitnessesPresentInMostRecentCompactBlock GUARDED_BY(cs_most_recent_
  */
 void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) {
     std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs> (*pblock, true);
-    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    std::shared_ptr<RelayMessageCache> pcmpctblock_msgs = std::make_shared<RelayMessageCache>();
 
     LOCK(cs_main);
 
@@ -922,13 +1100,14 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
         most_recent_block_hash = hashBlock;
         most_recent_block = pblock;
         most_recent_compact_block = pcmpctblock;
+        most_recent_block_msgs = std::make_shared<RelayMessageCache>();
+        most_recent_compact_block_msgs = pcmpctblock_msgs;
         fWitnessesPresentInMostRecentCompactBlock = fWitnessEnabled;
     }
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
+    connman->ForEachNode([this, &pcmpctblock, &pcmpctblock_msgs, pindex, fWitnessEnabled, &hashBlock](CNode* pnode) {
         AssertLockHeld(cs_main);
 
-        // TODO: Avoid the repeated-serialization here
         if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
             return;
         ProcessBlockAvailability(pnode->GetId());
@@ -940,7 +1119,7 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
 
             LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
                     hashBlock.ToString(), pnode->GetId());
-            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            connman->PushMessage(pnode, *pcmpctblock_msgs->Get(NetMsgType::CMPCTBLOCK, true, *pcmpctblock));
             state.pindexBestHeaderSent = pindex;
         }
     });
@@ -1141,12 +1320,16 @@ void static ProcessGetBlockData(CNode* pfrom, const CChainParams& chainparams, c
     bool send = false;
     std::shared_ptr<const CBlock> a_recent_block;
     std::shared_ptr<const CBlockHeaderAndShortTxIDs> a_recent_compact_block;
+    std::shared_ptr<RelayMessageCache> a_recent_block_msgs;
+    std::shared_ptr<RelayMessageCache> a_recent_compact_block_msgs;
     bool fWitnessesPresentInARecentCompactBlock;
     const Consensus::Params& consensusParams = chainparams.GetConsensus();
     {
         LOCK(cs_most_recent_block);
         a_recent_block = most_recent_block;
         a_recent_compact_block = most_recent_compact_block;
+        a_recent_block_msgs = most_recent_block_msgs;
+        a_recent_compact_block_msgs = most_recent_compact_block_msgs;
         fWitnessesPresentInARecentCompactBlock = fWitnessesPresentInMostRecentCompactBlock;
     }
 
@@ -1173,48 +1356,70 @@ void static ProcessGetBlockData(CNode* pfrom, const CChainParams& chainparams, c
         }
     }
 
-    LOCK(cs_main);
-    const CBlockIndex* pindex = LookupBlockIndex(inv.hash);
-    if (pindex) {
-        send = BlockRequestAllowed(pindex, consensusParams);
-        if (!send) {
-            LogPrint(BCLog::NET, "%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
-        }
-    }
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
-    // disconnect node in case we have reached the outbound limit for serving historical blocks
-    // never disconnect whitelisted nodes
-    if (send && connman->OutboundTargetReached(true) && ( ((pindexBestHeader != nullptr) && (pindexBestHeader->GetBlockTime() - pindex->GetBlockTime() > HISTORICAL_BLOCK_AGE)) || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_FILTERED_WITNESS_BLOCK) && !pfrom->fWhitelisted)
+    const CBlockIndex* pindex = nullptr;
+    bool fCmpctBlockAllowed = false;
+    bool fPeerWantsWitness = false;
+    uint256 hashTipContinue;
     {
-        LogPrint(BCLog::NET, "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
+        LOCK(cs_main);
+        pindex = LookupBlockIndex(inv.hash);
+        if (pindex) {
+            send = BlockRequestAllowed(pindex, consensusParams);
+            if (!send) {
+                LogPrint(BCLog::NET, "%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+            }
+        }
+        // disconnect node in case we have reached the outbound limit for serving historical blocks
+        // never disconnect whitelisted nodes
+        if (send && connman->OutboundTargetReached(true) && ( ((pindexBestHeader != nullptr) && (pindexBestHeader->GetBlockTime() - pindex->GetBlockTime() > HISTORICAL_BLOCK_AGE)) || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_FILTERED_WITNESS_BLOCK) && !pfrom->fWhitelisted)
+        {
+            LogPrint(BCLog::NET, "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
 
-        //disconnect node
-        pfrom->fDisconnect = true;
-        send = false;
-    }
-    // Avoid leaking prune-height by never sending blocks below the NODE_NETWORK_LIMITED threshold
-    if (send && !pfrom->fWhitelisted && (
-            (((pfrom->GetLocalServices() & NODE_NETWORK_LIMITED) == NODE_NETWORK_LIMITED) && ((pfrom->GetLocalServices() & NODE_NETWORK) != NODE_NETWORK) && (chainActive.Tip()->nHeight - pindex->nHeight > (int)NODE_NETWORK_LIMITED_MIN_BLOCKS + 2 /* add two blocks buffer extension for possible races */) )
-       )) {
-        LogPrint(BCLog::NET, "Ignore block request below NODE_NETWORK_LIMITED threshold from peer=%d\n", pfrom->GetId());
+            //disconnect node
+            pfrom->fDisconnect = true;
+            send = false;
+        }
+        // Avoid leaking prune-height by never sending blocks below the NODE_NETWORK_LIMITED threshold
+        if (send && !pfrom->fWhitelisted && (
+                (((pfrom->GetLocalServices() & NODE_NETWORK_LIMITED) == NODE_NETWORK_LIMITED) && ((pfrom->GetLocalServices() & NODE_NETWORK) != NODE_NETWORK) && (chainActive.Tip()->nHeight - pindex->nHeight > (int)NODE_NETWORK_LIMITED_MIN_BLOCKS + 2 /* add two blocks buffer extension for possible races */) )
+           )) {
+            LogPrint(BCLog::NET, "Ignore block request below NODE_NETWORK_LIMITED threshold from peer=%d\n", pfrom->GetId());
 
-        //disconnect node and prevent it from stalling (would otherwise wait for the missing block)
-        pfrom->fDisconnect = true;
-        send = false;
-    }
-    // Pruned nodes may have deleted the block, so check whether
-    // it's available before trying to send.
-    if (send && (pindex->nStatus & BLOCK_HAVE_DATA))
+            //disconnect node and prevent it from stalling (would otherwise wait for the missing block)
+            pfrom->fDisconnect = true;
+            send = false;
+        }
+        // Pruned nodes may have deleted the block, so check whether
+        // it's available before trying to send.
+        send = send && (pindex->nStatus & BLOCK_HAVE_DATA);
+        if (send) {
+            fCmpctBlockAllowed = CanDirectFetch(consensusParams) && pindex->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+            fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
+            if (inv.hash == pfrom->hashContinue) {
+                hashTipContinue = chainActive.Tip()->GetBlockHash();
+                pfrom->hashContinue.SetNull();
+            }
+        }
+    } // release cs_main: reading and serializing the block does not need it
+
+    if (send)
     {
         std::shared_ptr<const CBlock> pblock;
+        // The serialized forms of the most recent block are shared by all peers
+        std::shared_ptr<RelayMessageCache> pblock_msgs;
         if (a_recent_block && a_recent_block->GetHash() == pindex->GetBlockHash()) {
             pblock = a_recent_block;
+            pblock_msgs = a_recent_block_msgs;
         } else if (inv.type == MSG_WITNESS_BLOCK) {
             // Fast-path: in this case it is possible to serve the block directly from disk,
             // as the network format matches the format on disk
             std::vector<uint8_t> block_data;
             if (!ReadRawBlockFromDisk(block_data, pindex, chainparams.MessageStart(), true)) {
-                assert(!"cannot load block from disk");
+                // The block may have been pruned since we released cs_main
+                LogPrint(BCLog::NET, "cannot load block %s from disk, disconnect peer=%d\n", inv.hash.ToString(), pfrom->GetId());
+                pfrom->fDisconnect = true;
+                return;
             }
             connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, MakeSpan(block_data)));
             // Don't set pblock as we've sent the block
@@ -1222,12 +1427,16 @@ void static ProcessGetBlockData(CNode* pfrom, const CChainParams& chainparams, c
             // Send block from disk
             std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
             if (!ReadBlockFromDisk(*pblockRead, pindex, consensusParams, true)) {
-                assert(!"cannot load block from disk");
+                LogPrint(BCLog::NET, "cannot load block %s from disk, disconnect peer=%d\n", inv.hash.ToString(), pfrom->GetId());
+                pfrom->fDisconnect = true;
+                return;
             }
             pblock = pblockRead;
         }
         if (pblock) {
-            if (inv.type == MSG_BLOCK)
+            if ((inv.type == MSG_BLOCK || inv.type == MSG_WITNESS_BLOCK) && pblock_msgs)
+                connman->PushMessage(pfrom, *pblock_msgs->Get(NetMsgType::BLOCK, inv.type == MSG_WITNESS_BLOCK, *pblock));
+            else if (inv.type == MSG_BLOCK)
                 connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *pblock));
             else if (inv.type == MSG_WITNESS_BLOCK)
                 connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, *pblock));
@@ -1263,15 +1472,16 @@ void static ProcessGetBlockData(CNode* pfrom, const CChainParams& chainparams, c
                 // they won't have a useful mempool to match against a compact block,
                 // and we don't feel like constructing the object for them, so
                 // instead we respond with the full, non-compact block.
-                bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
                 int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
-                if (CanDirectFetch(consensusParams) && pindex->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
+                if (fCmpctBlockAllowed) {
                     if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == pindex->GetBlockHash()) {
-                        connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
+                        connman->PushMessage(pfrom, *a_recent_compact_block_msgs->Get(NetMsgType::CMPCTBLOCK, fPeerWantsWitness, *a_recent_compact_block));
                     } else {
                         CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fPeerWantsWitness);
                         connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
                     }
+                } else if (pblock_msgs) {
+                    connman->PushMessage(pfrom, *pblock_msgs->Get(NetMsgType::BLOCK, fPeerWantsWitness, *pblock));
                 } else {
                     connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
                 }
@@ -1279,15 +1489,14 @@ void static ProcessGetBlockData(CNode* pfrom, const CChainParams& chainparams, c
         }
 
         // Trigger the peer node to send a getblocks request for the next batch of inventory
-        if (inv.hash == pfrom->hashContinue)
+        if (!hashTipContinue.IsNull())
         {
             // Bypass PushInventory, this must send even if redundant,
             // and we want it right after the last block so they don't
             // wait for other stuff first.
             std::vector<CInv> vInv;
-            vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
+            vInv.push_back(CInv(MSG_BLOCK, hashTipContinue));
             connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInv));
-            pfrom->hashContinue.SetNull();
         }
     }
 }
@@ -1317,7 +1526,7 @@ void static ProcessGetData(CNode* pfrom, const CChainParams& chainparams, CConnm
             auto mi = mapRelay.find(inv.hash);
             int nSendFlags = (inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0);
             if (mi != mapRelay.end()) {
-                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::TX, *mi->second));
+                connman->PushMessage(pfrom, *mi->second.msgs.Get(NetMsgType::TX, inv.type == MSG_WITNESS_TX, *mi->second.tx));
                 push = true;
             } else if (pfrom->timeLastMempoolReq) {
                 auto txinfo = mempool.info(inv.hash);
@@ -1522,8 +1731,9 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
         if (fCanDirectFetch && pindexLast->IsValid(BLOCK_VALID_TREE) && chainActive.Tip()->nChainWork <= pindexLast->nChainWork) {
             std::vector<const CBlockIndex*> vToFetch;
             const CBlockIndex *pindexWalk = pindexLast;
+            const int nBlocksInFlightLimit = GetBlocksInFlightLimit(*nodestate);
             // Calculate all the blocks we'd need to switch to pindexLast, up to a limit.
-            while (pindexWalk && !chainActive.Contains(pindexWalk) && vToFetch.size() <= MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+            while (pindexWalk && !chainActive.Contains(pindexWalk) && vToFetch.size() <= (size_t)nBlocksInFlightLimit) {
                 if (!(pindexWalk->nStatus & BLOCK_HAVE_DATA) &&
                         !mapBlocksInFlight.count(pindexWalk->GetBlockHash()) &&
                         (!IsWitnessEnabled(pindexWalk->pprev, chainparams.GetConsensus()) || State(pfrom->GetId())->fHaveWitness)) {
@@ -1544,7 +1754,7 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
                 std::vector<CInv> vGetData;
                 // Download as much as possible, from earliest to latest.
                 for (const CBlockIndex *pindex : reverse_iterate(vToFetch)) {
-                    if (nodestate->nBlocksInFlight >= MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                    if (nodestate->nBlocksInFlight >= nBlocksInFlightLimit) {
                         // Can't download any more from this peer
                         break;
                     }
@@ -2518,7 +2728,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         // We want to be a bit conservative just to be extra careful about DoS
         // possibilities in compact block processing...
         if (pindex->nHeight <= chainActive.Height() + 2) {
-            if ((!fAlreadyInFlight && nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) ||
+            if ((!fAlreadyInFlight && nodestate->nBlocksInFlight < GetBlocksInFlightLimit(*nodestate)) ||
                  (fAlreadyInFlight && blockInFlightIt->second.first == pfrom->GetId())) {
                 std::list<QueuedBlock>::iterator* queuedBlockIt = nullptr;
                 if (!MarkBlockAsInFlight(pfrom->GetId(), pindex->GetBlockHash(), pindex, &queuedBlockIt)) {
@@ -2744,6 +2954,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        const size_t nBlockSize = vRecv.size();
         vRecv >> *pblock;
 
         LogPrint(BCLog::NET, "received block %s peer=%d\n", pblock->GetHash().ToString(), pfrom->GetId());
@@ -2752,6 +2963,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         const uint256 hash(pblock->GetHash());
         {
             LOCK(cs_main);
+            UpdateBlockDownloadStats(pfrom->GetId(), hash, nBlockSize);
             // Also always process if we requested the block explicitly, as we may
             // need it even though it is not a candidate for a new best tip.
             forceProcessing |= MarkBlockAsReceived(hash);
@@ -2790,7 +3002,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_addrSend);
+            pfrom->vAddrToSend.clear();
+        }
         std::vector<CAddress> vAddr = connman->GetAddresses();
         FastRandomContext insecure_rand;
         for (const CAddress &addr : vAddr)
@@ -3071,17 +3286,8 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
     // Message size
     unsigned int nMessageSize = hdr.nMessageSize;
 
-    // Checksum
+    // The checksum was already verified by the socket handler
     CDataStream& vRecv = msg.vRecv;
-    const uint256& hash = msg.GetMessageHash();
-    if (memcmp(hash.begin(), hdr.pchChecksum, CMessageHeader::CHECKSUM_SIZE) != 0)
-    {
-        LogPrint(BCLog::NET, "%s(%s, %u bytes): CHECKSUM ERROR expected %s was %s\n", __func__,
-           SanitizeString(strCommand), nMessageSize,
-           HexStr(hash.begin(), hash.begin()+CMessageHeader::CHECKSUM_SIZE),
-           HexStr(hdr.pchChecksum, hdr.pchChecksum+CMessageHeader::CHECKSUM_SIZE));
-        return fMoreWork;
-    }
 
     // Process message
     bool fRet = false;
@@ -3271,18 +3477,18 @@ void PeerLogicValidation::CheckForStaleTipAndEvictPeers(const Consensus::Params
 namespace {
 class CompareInvMempoolOrder
 {
-    CTxMemPool *mp;
 public:
-    explicit CompareInvMempoolOrder(CTxMemPool *_mempool)
-    {
-        mp = _mempool;
-    }
-
-    bool operator()(std::set<uint256>::iterator a, std::set<uint256>::iterator b)
+    bool operator()(const TxRelayCache::EntryRef& a, const TxRelayCache::EntryRef& b) const
     {
         /* As std::make_heap produces a max-heap, we want the entries with the
-         * fewest ancestors/highest fee to sort later. */
-        return mp->CompareDepthAndScore(*b, *a);
+         * fewest ancestors/highest fee to sort later. Like
+         * CTxMemPool::CompareDepthAndScore, this uses the unmodified feerate
+         * so the order does not leak prioritisation. */
+        if (a->info.nCountWithAncestors != b->info.nCountWithAncestors)
+            return a->info.nCountWithAncestors > b->info.nCountWithAncestors;
+        if (a->info.feeRate != b->info.feeRate)
+            return a->info.feeRate < b->info.feeRate;
+        return a->info.tx->GetHash() < b->info.tx->GetHash();
     }
 };
 }
@@ -3347,6 +3553,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
         //
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
+            LOCK(pto->cs_addrSend);
             std::vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
             for (const CAddress& addr : pto->vAddrToSend)
@@ -3484,7 +3691,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
                         LOCK(cs_most_recent_block);
                         if (most_recent_block_hash == pBestIndex->GetBlockHash()) {
                             if (state.fWantsCmpctWitness || !fWitnessesPresentInMostRecentCompactBlock)
-                                connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *most_recent_compact_block));
+                                connman->PushMessage(pto, *most_recent_compact_block_msgs->Get(NetMsgType::CMPCTBLOCK, state.fWantsCmpctWitness, *most_recent_compact_block));
                             else {
                                 CBlockHeaderAndShortTxIDs cmpctblock(*most_recent_block, state.fWantsCmpctWitness);
                                 connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
@@ -3614,11 +3821,20 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
 
             // Determine transactions to relay
             if (fSendTrickle) {
-                // Produce a vector with all candidates for sending
-                std::vector<std::set<uint256>::iterator> vInvTx;
-                vInvTx.reserve(pto->setInventoryTxToSend.size());
-                for (std::set<uint256>::iterator it = pto->setInventoryTxToSend.begin(); it != pto->setInventoryTxToSend.end(); it++) {
-                    vInvTx.push_back(it);
+                // Produce a vector with all candidates for sending that are still in the mempool
+                std::vector<uint256> vCandidates(pto->setInventoryTxToSend.begin(), pto->setInventoryTxToSend.end());
+                std::vector<TxRelayCache::EntryRef> vInvTx = g_tx_relay_cache.Get(vCandidates, nNow);
+                for (size_t i = 0; i < vInvTx.size();) {
+                    if (vInvTx[i]->info.tx) {
+                        i++;
+                        continue;
+                    }
+                    // Not in the mempool anymore? don't bother sending it.
+                    pto->setInventoryTxToSend.erase(vCandidates[i]);
+                    vInvTx[i] = std::move(vInvTx.back());
+                    vCandidates[i] = vCandidates.back();
+                    vInvTx.pop_back();
+                    vCandidates.pop_back();
                 }
                 CAmount filterrate = 0;
                 {
@@ -3627,7 +3843,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
                 }
                 // Topologically and fee-rate sort the inventory we send for privacy and priority reasons.
                 // A heap is used so that not all items need sorting if only a few are being sent.
-                CompareInvMempoolOrder compareInvMempoolOrder(&mempool);
+                CompareInvMempoolOrder compareInvMempoolOrder;
                 std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
                 // No reason to drain out at many times the network's capacity,
                 // especially since we have many peers and some will draw much shorter delays.
@@ -3636,20 +3852,16 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
                 while (!vInvTx.empty() && nRelayedTransactions < INVENTORY_BROADCAST_MAX) {
                     // Fetch the top element from the heap
                     std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
-                    std::set<uint256>::iterator it = vInvTx.back();
+                    TxRelayCache::EntryRef entry = std::move(vInvTx.back());
                     vInvTx.pop_back();
-                    uint256 hash = *it;
+                    const TxMempoolInfo& txinfo = entry->info;
+                    uint256 hash = txinfo.tx->GetHash();
                     // Remove it from the to-be-sent set
-                    pto->setInventoryTxToSend.erase(it);
+                    pto->setInventoryTxToSend.erase(hash);
                     // Check if not in the filter already
                     if (pto->filterInventoryKnown.contains(hash)) {
                         continue;
                     }
-                    // Not in the mempool anymore? don't bother sending it.
-                    auto txinfo = mempool.info(hash);
-                    if (!txinfo.tx) {
-                        continue;
-                    }
                     if (filterrate && txinfo.feeRate.GetFeePerK() < filterrate) {
                         continue;
                     }
@@ -3665,7 +3877,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
                             vRelayExpiration.pop_front();
                         }
 
-                        auto ret = mapRelay.insert(std::make_pair(hash, std::move(txinfo.tx)));
+                        auto ret = mapRelay.emplace(hash, txinfo.tx);
                         if (ret.second) {
                             vRelayExpiration.push_back(std::make_pair(nNow + 15 * 60 * 1000000, ret.first));
                         }
@@ -3746,10 +3958,12 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && ((fFetch && !pto->m_limited_node) || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        const int nBlocksInFlightLimit = GetBlocksInFlightLimit(state);
+        if (!pto->fClient && ((fFetch && !pto->m_limited_node) || !IsInitialBlockDownload()) && state.nBlocksInFlight < nBlocksInFlightLimit) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            const CBlockIndex* pindexStalled = nullptr;
+            FindNextBlocksToDownload(pto->GetId(), nBlocksInFlightLimit - state.nBlocksInFlight, vToDownload, staller, pindexStalled, consensusParams);
             for (const CBlockIndex *pindex : vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(pto);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
@@ -3758,8 +3972,21 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
                     pindex->nHeight, pto->GetId());
             }
             if (state.nBlocksInFlight == 0 && staller != -1) {
-                if (State(staller)->nStallingSince == 0) {
-                    State(staller)->nStallingSince = nNow;
+                CNodeState *stallerState = State(staller);
+                // We are idle because the window is held back by a block another peer has
+                // been working on for a while. If we have proven faster than that peer, take
+                // the block over rather than waiting for the stall to time out.
+                if (pindexStalled && stallerState->vBlocksInFlight.front().hash == pindexStalled->GetBlockHash() &&
+                        nNow > stallerState->nDownloadingSince + 1000000 * BLOCK_STALLING_REREQUEST_TIMEOUT &&
+                        state.m_block_download_time != 0 &&
+                        (stallerState->m_block_download_time == 0 || state.m_block_download_time < stallerState->m_block_download_time)) {
+                    uint32_t nFetchFlags = GetFetchFlags(pto);
+                    vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindexStalled->GetBlockHash()));
+                    MarkBlockAsInFlight(pto->GetId(), pindexStalled->GetBlockHash(), pindexStalled);
+                    LogPrint(BCLog::NET, "Re-requesting stalled block %s (%d) from peer=%d, was in flight from peer=%d\n", pindexStalled->GetBlockHash().ToString(),
+                        pindexStalled->nHeight, pto->GetId(), staller);
+                } else if (stallerState->nStallingSince == 0) {
+                    stallerState->nStallingSince = nNow;
                     LogPrint(BCLog::NET, "Stall started peer=%d\n", staller);
                 }
             }
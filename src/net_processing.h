@@ -27,6 +27,7 @@ private:
 
 public:
     explicit PeerLogicValidation(CConnman* connman, CScheduler &scheduler, bool enable_bip61);
+    ~PeerLogicValidation();
 
     /**
      * Overridden from CValidationInterface.
@@ -83,6 +84,9 @@ struct CNodeStateStats {
     int nSyncHeight = -1;
     int nCommonHeight = -1;
     std::vector<int> vHeightInFlight;
+    int64_t m_block_download_time = 0;
+    int64_t m_block_download_rate = 0;
+    int m_blocks_in_flight_limit = 0;
 };
 
 /** Get statistics from node state */
@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <netaddress.h>
+#include <crypto/common.h>
 #include <hash.h>
 #include <utilstrencodings.h>
 #include <tinyformat.h>
@@ -389,6 +390,11 @@ uint64_t CNetAddr::GetHash() const
     return nRet;
 }
 
+uint64_t CNetAddr::GetSaltedHash(uint64_t k0, uint64_t k1) const
+{
+    return CSipHasher(k0, k1).Write(ReadLE64(&ip[0])).Write(ReadLE64(&ip[8])).Finalize();
+}
+
 // private extensions to enum Network, only returned by GetExtNetwork,
 // and only used in GetReachabilityFrom
 static const int NET_UNKNOWN = NET_MAX + 0;
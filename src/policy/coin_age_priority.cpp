@@ -93,6 +93,7 @@ void CTxMemPool::UpdateDependentPriorities(const CTransaction &tx, unsigned int
         uint256 hash = it->second->GetHash();
         txiter iter = mapTx.find(hash);
         mapTx.modify(iter, update_priority(nBlockHeight, addToChain ? tx.vout[i].nValue : -tx.vout[i].nValue));
+        m_snapshot.reset();
     }
 }
 
@@ -125,9 +126,9 @@ struct TxCoinAgePriorityCompare
 
 bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter)
 {
-    for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(iter))
+    for (const CTxMemPoolEntryRef& parent : mempool.GetMemPoolParents(iter))
     {
-        if (!inBlock.count(parent)) {
+        if (!inBlock.count(mempool.GetIter(parent))) {
             return true;
         }
     }
@@ -240,8 +241,9 @@ void BlockAssembler::addPriorityTxs(int &nPackagesSelected)
 
             // This tx was successfully added, so
             // add transactions that depend on this one to the priority queue to try again
-            for (CTxMemPool::txiter child : mempool.GetMemPoolChildren(iter))
+            for (const CTxMemPoolEntryRef& child_ref : mempool.GetMemPoolChildren(iter))
             {
+                CTxMemPool::txiter child = mempool.GetIter(child_ref);
                 waitPriIter wpiter = waitPriMap.find(child);
                 if (wpiter != waitPriMap.end()) {
                     vecPriority.push_back(TxCoinAgePriority(wpiter->second,child));
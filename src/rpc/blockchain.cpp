@@ -389,10 +389,8 @@ static std::string EntryDescriptionString()
            "    \"bip125-replaceable\" : true|false,  (boolean) Whether this transaction could be replaced due to BIP125 (replace-by-fee)\n";
 }
 
-static void entryToJSON(UniValue &info, const CTxMemPoolEntry &e) EXCLUSIVE_LOCKS_REQUIRED(::mempool.cs)
+static void entryToJSON(UniValue &info, const CTxMemPoolEntry &e, const uint256& wtxid, const std::vector<uint256>& vDepends, const std::vector<uint256>& vSpentBy, bool fReplaceable)
 {
-    AssertLockHeld(mempool.cs);
-
     UniValue fees(UniValue::VOBJ);
     fees.pushKV("base", ValueFromAmount(e.GetFee()));
     fees.pushKV("modified", ValueFromAmount(e.GetModifiedFee()));
@@ -415,14 +413,12 @@ static void entryToJSON(UniValue &info, const CTxMemPoolEntry &e) EXCLUSIVE_LOCK
     info.pushKV("ancestorcount", e.GetCountWithAncestors());
     info.pushKV("ancestorsize", e.GetSizeWithAncestors());
     info.pushKV("ancestorfees", e.GetModFeesWithAncestors());
-    info.pushKV("wtxid", mempool.vTxHashes[e.vTxHashesIdx].first.ToString());
+    info.pushKV("wtxid", wtxid.ToString());
     info.pushKV("hash", info["wtxid"]);
-    const CTransaction& tx = e.GetTx();
     std::set<std::string> setDepends;
-    for (const CTxIn& txin : tx.vin)
+    for (const uint256& dep : vDepends)
     {
-        if (mempool.exists(txin.prevout.hash))
-            setDepends.insert(txin.prevout.hash.ToString());
+        setDepends.insert(dep.ToString());
     }
 
     UniValue depends(UniValue::VARR);
@@ -434,15 +430,34 @@ static void entryToJSON(UniValue &info, const CTxMemPoolEntry &e) EXCLUSIVE_LOCK
     info.pushKV("depends", depends);
 
     UniValue spent(UniValue::VARR);
-    const CTxMemPool::txiter &it = mempool.mapTx.find(tx.GetHash());
-    const CTxMemPool::setEntries &setChildren = mempool.GetMemPoolChildren(it);
-    for (const CTxMemPool::txiter &childiter : setChildren) {
-        spent.push_back(childiter->GetTx().GetHash().ToString());
+    for (const uint256& child : vSpentBy) {
+        spent.push_back(child.ToString());
     }
 
     info.pushKV("spentby", spent);
 
     // Add opt-in RBF status
+    info.pushKV("bip125-replaceable", fReplaceable);
+}
+
+static void entryToJSON(UniValue &info, const CTxMemPoolEntry &e) EXCLUSIVE_LOCKS_REQUIRED(::mempool.cs)
+{
+    AssertLockHeld(mempool.cs);
+
+    const CTransaction& tx = e.GetTx();
+    std::vector<uint256> vDepends;
+    for (const CTxIn& txin : tx.vin)
+    {
+        if (mempool.exists(txin.prevout.hash))
+            vDepends.push_back(txin.prevout.hash);
+    }
+
+    std::vector<uint256> vSpentBy;
+    const CTxMemPool::txiter &it = mempool.mapTx.find(tx.GetHash());
+    for (const CTxMemPoolEntryRef& child : mempool.GetMemPoolChildren(it)) {
+        vSpentBy.push_back(child.get().GetTx().GetHash());
+    }
+
     bool rbfStatus = false;
     RBFTransactionState rbfState = IsRBFOptIn(tx, mempool);
     if (rbfState == RBFTransactionState::UNKNOWN) {
@@ -451,20 +466,22 @@ static void entryToJSON(UniValue &info, const CTxMemPoolEntry &e) EXCLUSIVE_LOCK
         rbfStatus = true;
     }
 
-    info.pushKV("bip125-replaceable", rbfStatus);
+    entryToJSON(info, e, mempool.vTxHashes[e.vTxHashesIdx], vDepends, vSpentBy, rbfStatus);
 }
 
 UniValue mempoolToJSON(bool fVerbose)
 {
     if (fVerbose)
     {
-        LOCK(mempool.cs);
+        // Render from a snapshot so that mempool.cs is not held while
+        // building the (potentially large) reply.
+        std::shared_ptr<const CTxMemPoolSnapshot> snapshot = mempool.GetSnapshot();
         UniValue o(UniValue::VOBJ);
-        for (const CTxMemPoolEntry& e : mempool.mapTx)
+        for (const CTxMemPoolSnapshot::Entry& e : snapshot->GetEntries())
         {
-            const uint256& hash = e.GetTx().GetHash();
+            const uint256& hash = e.entry.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
-            entryToJSON(info, e);
+            entryToJSON(info, e.entry, e.wtxid, e.vDepends, e.vSpentBy, e.fReplaceable);
             o.pushKV(hash.ToString(), info);
         }
         return o;
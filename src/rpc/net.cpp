@@ -101,6 +101,9 @@ static UniValue getpeerinfo(const JSONRPCRequest& request)
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
             "    ],\n"
+            "    \"inflight_limit\": n,       (numeric) The number of blocks we are willing to have in flight from this peer\n"
+            "    \"block_download_time\": n,  (numeric) Average time in seconds this peer took to deliver a requested block (if known)\n"
+            "    \"block_download_rate\": n,  (numeric) Average block download rate from this peer in bytes per second (if known)\n"
             "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
             "    \"minfeefilter\": n,         (numeric) The minimum fee rate for transactions this peer accepts\n"
             "    \"bytessent_per_msg\": {\n"
@@ -168,6 +171,11 @@ static UniValue getpeerinfo(const JSONRPCRequest& request)
                 heights.push_back(height);
             }
             obj.pushKV("inflight", heights);
+            obj.pushKV("inflight_limit", statestats.m_blocks_in_flight_limit);
+            if (statestats.m_block_download_time > 0) {
+                obj.pushKV("block_download_time", ((double)statestats.m_block_download_time) / 1e6);
+                obj.pushKV("block_download_rate", statestats.m_block_download_rate);
+            }
         }
         obj.pushKV("whitelisted", stats.fWhitelisted);
         obj.pushKV("minfeefilter", ValueFromAmount(stats.minFeeFilter));
@@ -373,6 +381,15 @@ static UniValue getnettotals(const JSONRPCRequest& request)
             "    \"serve_historical_blocks\": true|false,  (boolean) True if serving historical blocks\n"
             "    \"bytes_left_in_cycle\": t,               (numeric) Bytes left in current time cycle\n"
             "    \"time_left_in_cycle\": t                 (numeric) Seconds left in current time cycle\n"
+            "  },\n"
+            "  \"recvbuffers\":\n"
+            "  {\n"
+            "    \"pooled_bytes\": n,                      (numeric) Memory held by idle receive buffers\n"
+            "    \"per_msg\":                              (json object) Receive buffers per message type\n"
+            "    {\n"
+            "      \"addr\": { \"allocated\": n, \"reused\": n },   (json object) Buffers freshly allocated and taken from the pool\n"
+            "      ...\n"
+            "    }\n"
             "  }\n"
             "}\n"
             "\nExamples:\n"
@@ -395,6 +412,20 @@ static UniValue getnettotals(const JSONRPCRequest& request)
     outboundLimit.pushKV("bytes_left_in_cycle", g_connman->GetOutboundTargetBytesLeft());
     outboundLimit.pushKV("time_left_in_cycle", g_connman->GetMaxOutboundTimeLeftInCycle());
     obj.pushKV("uploadtarget", outboundLimit);
+
+    UniValue recvBuffers(UniValue::VOBJ);
+    recvBuffers.pushKV("pooled_bytes", (uint64_t)g_recv_buffer_pool.GetPooledBytes());
+    UniValue recvBuffersPerMsg(UniValue::VOBJ);
+    for (const auto& i : g_recv_buffer_pool.GetStats()) {
+        if (i.second.nAllocated == 0 && i.second.nReused == 0)
+            continue;
+        UniValue counts(UniValue::VOBJ);
+        counts.pushKV("allocated", i.second.nAllocated);
+        counts.pushKV("reused", i.second.nReused);
+        recvBuffersPerMsg.pushKV(i.first, counts);
+    }
+    recvBuffers.pushKV("per_msg", recvBuffersPerMsg);
+    obj.pushKV("recvbuffers", recvBuffers);
     return obj;
 }
 
@@ -12,7 +12,7 @@
 
 class CAddrManTest : public CAddrMan
 {
-    uint64_t state;
+    mutable uint64_t state;
 
 public:
     explicit CAddrManTest(bool makeDeterministic = true)
@@ -30,9 +30,11 @@ public:
     {
         nKey.SetNull();
         insecure_rand = FastRandomContext(true);
+        m_deterministic_readers = true;
     }
 
-    int RandomInt(int nMax) override
+    // The tests call Select and GetAddr from one thread only, so state needs no lock
+    int RandomInt(int nMax, FastRandomContext& rng) const override
     {
         state = (CHashWriter(SER_GETHASH, 0) << state).GetHash().GetCheapHash();
         return (unsigned int)(state % nMax);
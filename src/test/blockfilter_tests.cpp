@@ -0,0 +1,215 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilter.h>
+#include <chainparams.h>
+#include <coins.h>
+#include <index/blockfilterindex.h>
+#include <script/standard.h>
+#include <streams.h>
+#include <test/test_bitcoin.h>
+#include <undo.h>
+#include <utilstrencodings.h>
+#include <utiltime.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockfilter_tests)
+
+BOOST_AUTO_TEST_CASE(gcsfilter_test)
+{
+    GCSFilter::ElementSet included_elements, excluded_elements;
+    for (int i = 0; i < 100; ++i) {
+        GCSFilter::Element element1(32);
+        element1[0] = i;
+        included_elements.insert(std::move(element1));
+
+        GCSFilter::Element element2(32);
+        element2[1] = i;
+        excluded_elements.insert(std::move(element2));
+    }
+
+    GCSFilter filter(0, 0, 10, 1 << 10, included_elements);
+    for (const auto& element : included_elements) {
+        BOOST_CHECK(filter.Match(element));
+
+        auto insertion = excluded_elements.insert(element);
+        BOOST_CHECK(filter.MatchAny(excluded_elements));
+        excluded_elements.erase(insertion.first);
+    }
+
+    // Decoding the encoding gives back a filter matching the same elements.
+    GCSFilter decoded(0, 0, 10, 1 << 10, filter.GetEncoded());
+    BOOST_CHECK_EQUAL(decoded.GetN(), 100U);
+    for (const auto& element : included_elements) {
+        BOOST_CHECK(decoded.Match(element));
+    }
+
+    // A truncated encoding is rejected.
+    std::vector<unsigned char> truncated = filter.GetEncoded();
+    truncated.resize(truncated.size() / 2);
+    BOOST_CHECK_THROW(GCSFilter(0, 0, 10, 1 << 10, truncated), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_false_positive_rate)
+{
+    GCSFilter::ElementSet included_elements, excluded_elements;
+    for (int i = 0; i < 1000; ++i) {
+        GCSFilter::Element element1(32);
+        WriteLE32(element1.data(), i);
+        included_elements.insert(std::move(element1));
+
+        GCSFilter::Element element2(32);
+        WriteLE32(element2.data() + 4, i);
+        excluded_elements.insert(std::move(element2));
+    }
+
+    // With M = 2^10, about 1 in 1024 of the excluded elements matches.
+    GCSFilter filter(1, 2, 10, 1 << 10, included_elements);
+    int false_positives = 0;
+    for (const auto& element : excluded_elements) {
+        false_positives += filter.Match(element);
+    }
+    BOOST_CHECK(false_positives < 10);
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_default_constructor)
+{
+    GCSFilter filter;
+    BOOST_CHECK_EQUAL(filter.GetN(), 0U);
+    BOOST_CHECK_EQUAL(filter.GetEncoded().size(), 1U);
+    BOOST_CHECK(!filter.Match(GCSFilter::Element(32)));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_basic_test)
+{
+    CScript included_scripts[5], excluded_scripts[3];
+
+    // First two are outputs on a single transaction.
+    included_scripts[0] << std::vector<unsigned char>(65, 0) << OP_CHECKSIG;
+    included_scripts[1] << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    // Third is an output on a second transaction.
+    included_scripts[2] << OP_1 << std::vector<unsigned char>(33, 2) << OP_1 << OP_CHECKMULTISIG;
+
+    // The next two are spent by a single transaction.
+    included_scripts[3] << OP_0 << std::vector<unsigned char>(32, 3);
+    included_scripts[4] << OP_4 << OP_ADD << OP_8 << OP_EQUAL;
+
+    // OP_RETURN output is an output on the second transaction.
+    excluded_scripts[0] << OP_RETURN << std::vector<unsigned char>(40, 4);
+
+    // This script is not related to the block at all.
+    excluded_scripts[1] << std::vector<unsigned char>(33, 5) << OP_CHECKSIG;
+
+    // Empty scripts are excluded from the filter, whether created or spent.
+    excluded_scripts[2] = CScript();
+
+    CMutableTransaction tx_1;
+    tx_1.vout.emplace_back(100, included_scripts[0]);
+    tx_1.vout.emplace_back(200, included_scripts[1]);
+
+    CMutableTransaction tx_2;
+    tx_2.vout.emplace_back(300, included_scripts[2]);
+    tx_2.vout.emplace_back(0, excluded_scripts[0]);
+    tx_2.vout.emplace_back(400, excluded_scripts[2]);
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(tx_1));
+    block.vtx.push_back(MakeTransactionRef(tx_2));
+
+    CBlockUndo block_undo;
+    block_undo.vtxundo.emplace_back();
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(500, included_scripts[3]), 1000, true);
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(600, included_scripts[4]), 10000, false);
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(700, excluded_scripts[2]), 100000, false);
+
+    BlockFilter block_filter(BlockFilterType::BASIC, block, block_undo);
+    const GCSFilter& filter = block_filter.GetFilter();
+
+    for (const CScript& script : included_scripts) {
+        BOOST_CHECK(filter.Match(GCSFilter::Element(script.begin(), script.end())));
+    }
+    for (const CScript& script : excluded_scripts) {
+        BOOST_CHECK(!filter.Match(GCSFilter::Element(script.begin(), script.end())));
+    }
+
+    // Test serialization/unserialization.
+    BlockFilter block_filter2;
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << block_filter;
+    stream >> block_filter2;
+
+    BOOST_CHECK(block_filter.GetFilterType() == block_filter2.GetFilterType());
+    BOOST_CHECK(block_filter.GetBlockHash() == block_filter2.GetBlockHash());
+    BOOST_CHECK(block_filter.GetEncodedFilter() == block_filter2.GetEncodedFilter());
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_bip158_genesis)
+{
+    // The basic filter of the testnet genesis block, from the BIP 158 test vectors.
+    const std::unique_ptr<const CChainParams> testnet_params = CreateChainParams(CBaseChainParams::TESTNET);
+    BlockFilter block_filter(BlockFilterType::BASIC, testnet_params->GenesisBlock(), CBlockUndo());
+    BOOST_CHECK_EQUAL(HexStr(block_filter.GetEncodedFilter()), "019dfca8");
+}
+
+BOOST_FIXTURE_TEST_CASE(blockfilterindex_initial_sync, TestChain100Setup)
+{
+    BlockFilterIndex filter_index(BlockFilterType::BASIC, 1 << 20, true);
+
+    BlockFilter filter;
+    const CBlockIndex* tip;
+    {
+        LOCK(cs_main);
+        tip = chainActive.Tip();
+    }
+
+    // Filters should not be found in the index before it is started.
+    BOOST_CHECK(!filter_index.LookupFilter(tip, filter));
+
+    // BlockUntilSyncedToCurrentChain should return false before the index is started.
+    BOOST_CHECK(!filter_index.BlockUntilSyncedToCurrentChain());
+
+    filter_index.Start();
+
+    // Allow the filter index to catch up with the block index.
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!filter_index.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+
+    // Every block before the index started has a filter matching its coinbase output.
+    const CScript coinbase_script_pub_key = GetScriptForRawPubKey(coinbaseKey.GetPubKey());
+    const GCSFilter::Element coinbase_element(coinbase_script_pub_key.begin(), coinbase_script_pub_key.end());
+    for (const CBlockIndex* pindex = tip; pindex->nHeight > 0; pindex = pindex->pprev) {
+        BOOST_REQUIRE(filter_index.LookupFilter(pindex, filter));
+        BOOST_CHECK(filter.GetBlockHash() == pindex->GetBlockHash());
+        BOOST_CHECK(filter.GetFilter().Match(coinbase_element));
+    }
+
+    // New blocks make it into the index, and their filters cover the scripts they spend.
+    CScript other_script = GetScriptForDestination(coinbaseKey.GetPubKey().GetID());
+    for (int i = 0; i < 10; i++) {
+        std::vector<CMutableTransaction> no_txns;
+        const CBlock& block = CreateAndProcessBlock(no_txns, other_script);
+
+        BOOST_CHECK(filter_index.BlockUntilSyncedToCurrentChain());
+        const CBlockIndex* pindex;
+        {
+            LOCK(cs_main);
+            pindex = LookupBlockIndex(block.GetHash());
+        }
+        BOOST_REQUIRE(filter_index.LookupFilter(pindex, filter));
+        BOOST_CHECK(filter.GetFilter().Match(GCSFilter::Element(other_script.begin(), other_script.end())));
+        BOOST_CHECK(!filter.GetFilter().Match(coinbase_element));
+    }
+
+    filter_index.Stop(); // Stop thread before calling destructor
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -58,6 +58,22 @@ struct FailingCheck {
     };
 };
 
+struct IndexedFailingCheck {
+    size_t check_id;
+    bool fails;
+    IndexedFailingCheck(size_t check_id_in, bool fails_in) : check_id(check_id_in), fails(fails_in){};
+    IndexedFailingCheck() : check_id(0), fails(false){};
+    bool operator()()
+    {
+        return !fails;
+    }
+    void swap(IndexedFailingCheck& x)
+    {
+        std::swap(check_id, x.check_id);
+        std::swap(fails, x.fails);
+    };
+};
+
 struct UniqueCheck {
     static std::mutex m;
     static std::unordered_multiset<size_t> results;
@@ -138,6 +154,7 @@ std::atomic<size_t> MemoryCheck::fake_allocated_memory{0};
 typedef CCheckQueue<FakeCheckCheckCompletion> Correct_Queue;
 typedef CCheckQueue<FakeCheck> Standard_Queue;
 typedef CCheckQueue<FailingCheck> Failing_Queue;
+typedef CCheckQueue<IndexedFailingCheck> IndexedFailing_Queue;
 typedef CCheckQueue<UniqueCheck> Unique_Queue;
 typedef CCheckQueue<MemoryCheck> Memory_Queue;
 typedef CCheckQueue<FrozenCleanupCheck> FrozenCleanup_Queue;
@@ -269,6 +286,37 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Recovers_From_Failure)
     tg.join_all();
 }
 
+// Test that the check that failed is handed back, and that the next run does
+// not see it again.
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Reports_Failure)
+{
+    auto fail_queue = std::unique_ptr<IndexedFailing_Queue>(new IndexedFailing_Queue {QUEUE_BATCH_SIZE});
+    boost::thread_group tg;
+    for (auto x = 0; x < nScriptCheckThreads; ++x) {
+       tg.create_thread([&]{fail_queue->Thread();});
+    }
+
+    for (auto times = 0; times < 100; ++times) {
+        // Every other run has no failure at all
+        const size_t fail_id = times % 2 ? 1 + InsecureRandRange(1000) : 0;
+        CCheckQueueControl<IndexedFailingCheck> control(fail_queue.get());
+        {
+            std::vector<IndexedFailingCheck> vChecks;
+            for (size_t i = 1; i <= 1000; ++i) {
+                vChecks.emplace_back(i, i == fail_id);
+            }
+            control.Add(vChecks);
+        }
+        IndexedFailingCheck failed;
+        bool r = control.Wait(&failed);
+        BOOST_REQUIRE_EQUAL(r, fail_id == 0);
+        BOOST_REQUIRE_EQUAL(failed.check_id, fail_id);
+        BOOST_REQUIRE_EQUAL(failed.fails, fail_id != 0);
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
 // Test that unique checks are actually all called individually, rather than
 // just one check being called repeatedly. Test that checks are not called
 // more than once as well
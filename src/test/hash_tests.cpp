@@ -145,6 +145,23 @@ BOOST_AUTO_TEST_CASE(siphash)
         BOOST_CHECK_EQUAL(SipHashUint256(k1, k2, x), sip256.Finalize());
         BOOST_CHECK_EQUAL(SipHashUint256Extra(k1, k2, x, n), sip288.Finalize());
     }
+
+    // Check consistency between SipHashUint256Many and SipHashUint256, including
+    // counts that are not a multiple of the batch width.
+    uint64_t k1 = ctx.rand64();
+    uint64_t k2 = ctx.rand64();
+    std::vector<uint256> vals;
+    for (int i = 0; i < 11; ++i) {
+        vals.push_back(InsecureRand256());
+    }
+    for (size_t count = 0; count <= vals.size(); ++count) {
+        std::vector<uint64_t> out(count + 1, 0);
+        SipHashUint256Many(k1, k2, vals.data(), count, out.data());
+        for (size_t i = 0; i < count; ++i) {
+            BOOST_CHECK_EQUAL(out[i], SipHashUint256(k1, k2, vals[i]));
+        }
+        BOOST_CHECK_EQUAL(out[count], 0U);
+    }
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include <test/test_bitcoin.h>
 
 #include <boost/test/unit_test.hpp>
+#include <algorithm>
 #include <list>
 #include <vector>
 
@@ -106,6 +107,134 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     BOOST_CHECK_EQUAL(testPool.size(), 0U);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolLinksTest)
+{
+    // Test the parent/child links kept in each CTxMemPoolEntry
+
+    TestMemPoolEntryHelper entry;
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(3);
+    for (int i = 0; i < 3; i++)
+    {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 33000LL;
+    }
+    CMutableTransaction txChild[3];
+    for (int i = 0; i < 3; i++)
+    {
+        txChild[i].vin.resize(1);
+        txChild[i].vin[0].scriptSig = CScript() << OP_11;
+        txChild[i].vin[0].prevout.hash = txParent.GetHash();
+        txChild[i].vin[0].prevout.n = i;
+        txChild[i].vout.resize(1);
+        txChild[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txChild[i].vout[0].nValue = 11000LL;
+    }
+
+    CTxMemPool testPool;
+    LOCK(testPool.cs);
+
+    testPool.addUnchecked(txParent.GetHash(), entry.FromTx(txParent));
+    const size_t nParentOnlyUsage = testPool.DynamicMemoryUsage();
+    for (int i = 0; i < 3; i++) {
+        testPool.addUnchecked(txChild[i].GetHash(), entry.FromTx(txChild[i]));
+    }
+
+    CTxMemPool::txiter parentIt = testPool.mapTx.find(txParent.GetHash());
+    const CTxMemPoolEntry::Links& children = testPool.GetMemPoolChildren(parentIt);
+    BOOST_CHECK(testPool.GetMemPoolParents(parentIt).empty());
+    BOOST_REQUIRE_EQUAL(children.size(), 3U);
+    for (size_t i = 1; i < children.size(); i++) {
+        BOOST_CHECK(children[i - 1].get().GetTx().GetHash() < children[i].get().GetTx().GetHash());
+    }
+    for (int i = 0; i < 3; i++) {
+        CTxMemPool::txiter childIt = testPool.mapTx.find(txChild[i].GetHash());
+        BOOST_REQUIRE_EQUAL(testPool.GetMemPoolParents(childIt).size(), 1U);
+        BOOST_CHECK(testPool.GetIter(testPool.GetMemPoolParents(childIt)[0]) == parentIt);
+        BOOST_CHECK(testPool.GetMemPoolChildren(childIt).empty());
+    }
+
+    testPool.removeRecursive(txChild[1]);
+    BOOST_CHECK_EQUAL(testPool.GetMemPoolChildren(parentIt).size(), 2U);
+
+    // Once the children are gone, so is all of their link bookkeeping
+    testPool.removeRecursive(txChild[0]);
+    testPool.removeRecursive(txChild[2]);
+    BOOST_CHECK(testPool.GetMemPoolChildren(parentIt).empty());
+    BOOST_CHECK_EQUAL(testPool.DynamicMemoryUsage(), nParentOnlyUsage);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolEntryUsageTest)
+{
+    // Compare the usage reported for each entry of a fixed set of transactions
+    // against what it was when the links lived in a separate mapLinks of
+    // std::sets (with the entry itself 256 bytes on 64-bit platforms).
+    struct BaselineTxLinks {
+        CTxMemPool::setEntries parents;
+        CTxMemPool::setEntries children;
+    };
+    static_assert(sizeof(void*) != 8 || sizeof(CTxMemPoolEntry) <= 256, "mempool entries must not grow");
+
+    TestMemPoolEntryHelper entry;
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(3);
+    for (int i = 0; i < 3; i++) {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 33000LL;
+    }
+    std::vector<CMutableTransaction> txs{txParent};
+    CMutableTransaction txJoin;
+    for (int i = 0; i < 3; i++) {
+        CMutableTransaction txChild;
+        txChild.vin.resize(1);
+        txChild.vin[0].scriptSig = CScript() << OP_11;
+        txChild.vin[0].prevout = COutPoint(txParent.GetHash(), i);
+        txChild.vout.resize(1);
+        txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txChild.vout[0].nValue = 11000LL;
+        txs.push_back(txChild);
+        txJoin.vin.emplace_back(COutPoint(txChild.GetHash(), 0), CScript() << OP_11);
+    }
+    txJoin.vout.resize(1);
+    txJoin.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txJoin.vout[0].nValue = 30000LL;
+    txs.push_back(txJoin);
+
+    CTxMemPool testPool;
+    LOCK(testPool.cs);
+    for (const CMutableTransaction& tx : txs) {
+        testPool.addUnchecked(tx.GetHash(), entry.FromTx(tx));
+    }
+
+    size_t nUsage = 0;
+    for (const CMutableTransaction& tx : txs) {
+        CTxMemPool::txiter it = testPool.mapTx.find(tx.GetHash());
+        std::map<CTxMemPool::txiter, BaselineTxLinks, CTxMemPool::CompareIteratorByHash> mapLinks;
+        BaselineTxLinks& links = mapLinks[it];
+        for (const CTxMemPoolEntryRef& parent : testPool.GetMemPoolParents(it)) {
+            links.parents.insert(testPool.GetIter(parent));
+        }
+        for (const CTxMemPoolEntryRef& child : testPool.GetMemPoolChildren(it)) {
+            links.children.insert(testPool.GetIter(child));
+        }
+        const size_t nEntry = memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) + it->DynamicMemoryUsage();
+        const size_t nEntryUsage = nEntry +
+            memusage::DynamicUsage(testPool.GetMemPoolParents(it)) + memusage::DynamicUsage(testPool.GetMemPoolChildren(it));
+        const size_t nBaselineUsage = nEntry +
+            memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(links.parents) + memusage::DynamicUsage(links.children);
+        BOOST_CHECK_LT(nEntryUsage, nBaselineUsage);
+        nUsage += nEntryUsage;
+    }
+    // Nothing else is accounted per entry
+    BOOST_CHECK_EQUAL(testPool.DynamicMemoryUsage() - nUsage,
+                      memusage::DynamicUsage(testPool.mapNextTx) + memusage::DynamicUsage(testPool.vTxHashes) +
+                      memusage::DynamicUsage(testPool.vTxHashesEntries));
+}
+
 template<typename name>
 static void CheckSort(CTxMemPool &pool, std::vector<std::string> &sortedOrder) EXCLUSIVE_LOCKS_REQUIRED(pool.cs)
 {
@@ -419,6 +548,142 @@ BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
 }
 
 
+BOOST_AUTO_TEST_CASE(MempoolRemoveForBlockTest)
+{
+    // Confirm the top of a diamond in one block and check that the remaining
+    // transactions no longer count the confirmed ones as ancestors.
+    CTxMemPool pool;
+    LOCK(pool.cs);
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction tx1;
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_1;
+    tx1.vout.resize(2);
+    for (CTxOut& out : tx1.vout) {
+        out.scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        out.nValue = 10 * COIN;
+    }
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(10000LL).SigOpsCost(4).FromTx(tx1));
+
+    CMutableTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+    tx2.vout = tx1.vout;
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(20000LL).FromTx(tx2));
+
+    CMutableTransaction tx3;
+    tx3.vin.resize(1);
+    tx3.vin[0].prevout = COutPoint(tx2.GetHash(), 0);
+    tx3.vout.resize(1);
+    tx3.vout[0] = tx1.vout[0];
+    pool.addUnchecked(tx3.GetHash(), entry.Fee(30000LL).SigOpsCost(8).FromTx(tx3));
+
+    CMutableTransaction tx4;
+    tx4.vin.resize(2);
+    tx4.vin[0].prevout = COutPoint(tx1.GetHash(), 1);
+    tx4.vin[1].prevout = COutPoint(tx2.GetHash(), 1);
+    tx4.vout.resize(1);
+    tx4.vout[0] = tx1.vout[0];
+    pool.addUnchecked(tx4.GetHash(), entry.Fee(40000LL).SigOpsCost(12).FromTx(tx4));
+
+    CMutableTransaction tx5;
+    tx5.vin.resize(1);
+    tx5.vin[0].prevout = COutPoint(tx4.GetHash(), 0);
+    tx5.vout.resize(1);
+    tx5.vout[0] = tx1.vout[0];
+    pool.addUnchecked(tx5.GetHash(), entry.Fee(50000LL).SigOpsCost(16).FromTx(tx5));
+
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(MakeTransactionRef(tx1));
+    vtx.push_back(MakeTransactionRef(tx2));
+    pool.removeForBlock(vtx, 1);
+    BOOST_CHECK_EQUAL(pool.size(), 3U);
+    BOOST_CHECK(!pool.exists(tx1.GetHash()));
+    BOOST_CHECK(!pool.exists(tx2.GetHash()));
+
+    CTxMemPool::txiter it3 = pool.mapTx.find(tx3.GetHash());
+    BOOST_CHECK(it3->GetMemPoolParentsConst().empty());
+    BOOST_CHECK_EQUAL(it3->GetCountWithAncestors(), 1U);
+    BOOST_CHECK_EQUAL(it3->GetSizeWithAncestors(), it3->GetTxSize());
+    BOOST_CHECK_EQUAL(it3->GetModFeesWithAncestors(), 30000LL);
+    BOOST_CHECK_EQUAL(it3->GetSigOpCostWithAncestors(), 8);
+
+    CTxMemPool::txiter it4 = pool.mapTx.find(tx4.GetHash());
+    CTxMemPool::txiter it5 = pool.mapTx.find(tx5.GetHash());
+    BOOST_CHECK(it4->GetMemPoolParentsConst().empty());
+    BOOST_CHECK_EQUAL(it4->GetCountWithAncestors(), 1U);
+    BOOST_CHECK_EQUAL(it4->GetSizeWithAncestors(), it4->GetTxSize());
+    BOOST_CHECK_EQUAL(it4->GetModFeesWithAncestors(), 40000LL);
+    BOOST_CHECK_EQUAL(it4->GetSigOpCostWithAncestors(), 12);
+    BOOST_CHECK_EQUAL(it4->GetCountWithDescendants(), 2U);
+    BOOST_CHECK_EQUAL(it5->GetCountWithAncestors(), 2U);
+    BOOST_CHECK_EQUAL(it5->GetSizeWithAncestors(), it4->GetTxSize() + it5->GetTxSize());
+    BOOST_CHECK_EQUAL(it5->GetModFeesWithAncestors(), 90000LL);
+    BOOST_CHECK_EQUAL(it5->GetSigOpCostWithAncestors(), 28);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSnapshotTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction parent;
+    parent.vin.resize(1);
+    parent.vin[0].scriptSig = CScript() << OP_1;
+    parent.vin[0].nSequence = 0; // signals BIP125
+    parent.vout.resize(1);
+    parent.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    parent.vout[0].nValue = 10 * COIN;
+
+    CMutableTransaction child;
+    child.vin.resize(1);
+    child.vin[0].prevout = COutPoint(parent.GetHash(), 0);
+    child.vout = parent.vout;
+
+    CMutableTransaction other;
+    other.vin.resize(1);
+    other.vin[0].scriptSig = CScript() << OP_2;
+    other.vout = parent.vout;
+
+    LOCK(pool.cs);
+    pool.addUnchecked(parent.GetHash(), entry.Fee(1000LL).FromTx(parent));
+    pool.addUnchecked(child.GetHash(), entry.Fee(2000LL).FromTx(child));
+
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot = pool.GetSnapshot();
+    BOOST_CHECK_EQUAL(snapshot->GetEntries().size(), 2U);
+    // Unchanged mempool: the same snapshot is handed out again
+    BOOST_CHECK(pool.GetSnapshot() == snapshot);
+
+    for (const CTxMemPoolSnapshot::Entry& e : snapshot->GetEntries()) {
+        BOOST_CHECK(e.entry.GetMemPoolParentsConst().empty());
+        BOOST_CHECK(e.entry.GetMemPoolChildrenConst().empty());
+        BOOST_CHECK(e.fReplaceable);
+        if (e.entry.GetTx().GetHash() == child.GetHash()) {
+            BOOST_CHECK(e.vDepends == std::vector<uint256>{parent.GetHash()});
+            BOOST_CHECK(e.vSpentBy.empty());
+            BOOST_CHECK_EQUAL(e.entry.GetCountWithAncestors(), 2U);
+        } else {
+            BOOST_CHECK(e.vDepends.empty());
+            BOOST_CHECK(e.vSpentBy == std::vector<uint256>{child.GetHash()});
+        }
+    }
+
+    // Changing the mempool does not affect a snapshot already handed out
+    pool.addUnchecked(other.GetHash(), entry.Fee(3000LL).FromTx(other));
+    BOOST_CHECK_EQUAL(snapshot->GetEntries().size(), 2U);
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot2 = pool.GetSnapshot();
+    BOOST_CHECK(snapshot2 != snapshot);
+    BOOST_CHECK_EQUAL(snapshot2->GetEntries().size(), 3U);
+    for (const CTxMemPoolSnapshot::Entry& e : snapshot2->GetEntries()) {
+        BOOST_CHECK_EQUAL(e.fReplaceable, e.entry.GetTx().GetHash() != other.GetHash());
+    }
+
+    pool.removeRecursive(parent);
+    BOOST_CHECK_EQUAL(pool.GetSnapshot()->GetEntries().size(), 1U);
+    BOOST_CHECK_EQUAL(snapshot2->GetEntries().size(), 3U);
+}
+
 BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
 {
     CTxMemPool pool;
@@ -590,6 +855,167 @@ inline CTransactionRef make_tx(std::vector<CAmount>&& output_values, std::vector
 }
 
 
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitBatchedTest)
+{
+    // Batched eviction must remove the same lowest-feerate transactions as
+    // picking them one at a time. As it works from an estimate of the memory
+    // each removal frees, it may remove one more than strictly needed.
+    TestMemPoolEntryHelper entry;
+    std::vector<CMutableTransaction> txs(20);
+    for (size_t i = 0; i < txs.size(); i++) {
+        txs[i].vin.resize(1);
+        txs[i].vin[0].scriptSig = CScript() << (int64_t)i << OP_1;
+        txs[i].vout.resize(1);
+        txs[i].vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        txs[i].vout[0].nValue = 10 * COIN;
+    }
+
+    CTxMemPool serialPool, batchedPool;
+    LOCK2(serialPool.cs, batchedPool.cs);
+    for (CTxMemPool* pool : {&serialPool, &batchedPool}) {
+        for (size_t i = 0; i < txs.size(); i++) {
+            pool->addUnchecked(txs[i].GetHash(), entry.Fee(1000LL * (i + 1)).FromTx(txs[i]));
+        }
+    }
+
+    const size_t limit = serialPool.DynamicMemoryUsage() / 3;
+    std::vector<COutPoint> serialNoSpends, batchedNoSpends;
+    serialPool.TrimToSize(limit, &serialNoSpends);
+    batchedPool.TrimToSize(limit, &batchedNoSpends, true);
+
+    BOOST_CHECK(batchedPool.DynamicMemoryUsage() <= limit);
+    BOOST_CHECK(batchedPool.size() > 0);
+    BOOST_CHECK(batchedPool.size() <= serialPool.size());
+    BOOST_CHECK(batchedPool.size() + 1 >= serialPool.size());
+    for (size_t i = 0; i < txs.size(); i++) {
+        if (batchedPool.exists(txs[i].GetHash())) {
+            BOOST_CHECK(serialPool.exists(txs[i].GetHash()));
+            // Everything paying more stays as well
+            if (i + 1 < txs.size()) BOOST_CHECK(batchedPool.exists(txs[i + 1].GetHash()));
+        }
+    }
+    BOOST_CHECK(!batchedPool.exists(txs.front().GetHash()));
+    BOOST_CHECK(batchedPool.exists(txs.back().GetHash()));
+    BOOST_CHECK(batchedPool.GetMinFee(1) >= serialPool.GetMinFee(1));
+    BOOST_CHECK_EQUAL(batchedNoSpends.size(), txs.size() - batchedPool.size());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitBatchedRescoreTest)
+{
+    // Removing a package changes its ancestors' descendant scores, so batched
+    // eviction must not keep picking by the scores from before the removal.
+    //
+    // [txParent] <- [txLow]
+    //            <- [txHigh]
+    // [txMid]
+    //
+    // txLow goes first. With txLow in the pool txParent scores below txMid, but
+    // once txLow is gone it scores above it, so txMid has to go next.
+    TestMemPoolEntryHelper entry;
+    CTransactionRef txParent = make_tx(/* output_values */ {10 * COIN, 10 * COIN});
+    CTransactionRef txLow = make_tx(/* output_values */ {9 * COIN}, /* inputs */ {txParent});
+    CTransactionRef txHigh = make_tx(/* output_values */ {9 * COIN}, /* inputs */ {txParent}, /* input_indices */ {1});
+    CTransactionRef txMid = make_tx(/* output_values */ {8 * COIN});
+    std::vector<CTransactionRef> vFiller;
+    for (int i = 0; i < 10; i++) {
+        vFiller.push_back(make_tx(/* output_values */ {(i + 1) * COIN}));
+    }
+
+    CTxMemPool serialPool, batchedPool, expectedPool;
+    LOCK(serialPool.cs);
+    LOCK(batchedPool.cs);
+    LOCK(expectedPool.cs);
+    for (CTxMemPool* pool : {&serialPool, &batchedPool, &expectedPool}) {
+        pool->addUnchecked(txParent->GetHash(), entry.Fee(2000LL).FromTx(txParent));
+        pool->addUnchecked(txLow->GetHash(), entry.Fee(1000LL).FromTx(txLow));
+        pool->addUnchecked(txHigh->GetHash(), entry.Fee(10000LL).FromTx(txHigh));
+        pool->addUnchecked(txMid->GetHash(), entry.Fee(2100LL).FromTx(txMid));
+        for (const CTransactionRef& tx : vFiller) {
+            pool->addUnchecked(tx->GetHash(), entry.Fee(50000LL).FromTx(tx));
+        }
+    }
+    expectedPool.removeRecursive(*txLow);
+    expectedPool.removeRecursive(*txMid);
+    const size_t limit = expectedPool.DynamicMemoryUsage();
+
+    serialPool.TrimToSize(limit);
+    batchedPool.TrimToSize(limit, nullptr, true);
+
+    for (CTxMemPool* pool : {&serialPool, &batchedPool}) {
+        BOOST_CHECK(!pool->exists(txLow->GetHash()));
+        BOOST_CHECK(!pool->exists(txMid->GetHash()));
+        BOOST_CHECK(pool->exists(txParent->GetHash()));
+        BOOST_CHECK(pool->exists(txHigh->GetHash()));
+        BOOST_CHECK_EQUAL(pool->size(), expectedPool.size());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitBatchedChainsTest)
+{
+    // Many chains and small trees with fees going up and down along them, so
+    // that picking a package often changes the score of ancestors still in the
+    // pool. Batched eviction must remove what picking one package at a time
+    // does (give or take the last package, as it works from an estimate).
+    TestMemPoolEntryHelper entry;
+    FastRandomContext det_rand(true);
+    std::vector<std::pair<CTransactionRef, CAmount>> txs;
+    for (int i = 0; i < 40; i++) {
+        std::vector<CTransactionRef> chain{make_tx(/* output_values */ {10 * COIN + i, 10 * COIN})};
+        txs.emplace_back(chain.back(), 1000 + det_rand.randrange(20000));
+        for (int j = 1; j < 12; j++) {
+            // Mostly extend the chain, sometimes branch off an earlier entry
+            const CTransactionRef& parent = det_rand.randrange(4) ? chain.back() : chain[det_rand.randrange(chain.size())];
+            const uint32_t index = parent == chain.back() ? 0 : 1;
+            chain.push_back(make_tx(/* output_values */ {COIN + j, COIN}, /* inputs */ {parent}, /* input_indices */ {index}));
+            txs.emplace_back(chain.back(), 1000 + det_rand.randrange(20000));
+        }
+    }
+
+    CTxMemPool serialPool, batchedPool;
+    LOCK2(serialPool.cs, batchedPool.cs);
+    for (CTxMemPool* pool : {&serialPool, &batchedPool}) {
+        for (const auto& tx : txs) {
+            if (pool->exists(tx.first->GetHash())) continue;
+            // Branches may double spend an output; skip those
+            bool conflict = false;
+            for (const CTxIn& txin : tx.first->vin) conflict |= pool->mapNextTx.count(txin.prevout) > 0;
+            if (!conflict) pool->addUnchecked(tx.first->GetHash(), entry.Fee(tx.second).FromTx(tx.first));
+        }
+    }
+    BOOST_CHECK(serialPool.size() > 300);
+
+    for (size_t divisor : {2, 5, 50}) {
+        const size_t limit = serialPool.DynamicMemoryUsage() * (divisor - 1) / divisor;
+        serialPool.TrimToSize(limit);
+        batchedPool.TrimToSize(limit, nullptr, true);
+        BOOST_CHECK(batchedPool.DynamicMemoryUsage() <= limit);
+        BOOST_CHECK(batchedPool.size() <= serialPool.size());
+        BOOST_CHECK(batchedPool.size() + 12 >= serialPool.size());
+        for (const auto& tx : txs) {
+            if (batchedPool.exists(tx.first->GetHash())) BOOST_CHECK(serialPool.exists(tx.first->GetHash()));
+        }
+        // Batched removal updates the remaining entries from its own tally
+        // of what was staged; it must leave the same state behind.
+        for (CTxMemPool::txiter it = batchedPool.mapTx.begin(); it != batchedPool.mapTx.end(); ++it) {
+            CTxMemPool::setEntries setDescendants;
+            batchedPool.CalculateDescendants(it, setDescendants);
+            int64_t nSize = 0;
+            CAmount nFees = 0;
+            for (CTxMemPool::txiter descendantIt : setDescendants) {
+                nSize += descendantIt->GetTxSize();
+                nFees += descendantIt->GetModifiedFee();
+            }
+            BOOST_CHECK_EQUAL(it->GetCountWithDescendants(), setDescendants.size());
+            BOOST_CHECK_EQUAL(it->GetSizeWithDescendants(), nSize);
+            BOOST_CHECK_EQUAL(it->GetModFeesWithDescendants(), nFees);
+            for (const CTxMemPoolEntry& parent : it->GetMemPoolParentsConst()) {
+                const CTxMemPoolEntry::Links& siblings = parent.GetMemPoolChildrenConst();
+                BOOST_CHECK(std::any_of(siblings.begin(), siblings.end(), [&](const CTxMemPoolEntryRef& child) { return &child.get() == &*it; }));
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(MempoolAncestryTests)
 {
     size_t ancestors, descendants;
@@ -25,6 +25,7 @@ public:
     {
         nKey.SetNull();
         insecure_rand = FastRandomContext(true);
+        m_deterministic_readers = true;
     }
 };
 
@@ -227,4 +228,197 @@ BOOST_AUTO_TEST_CASE(ipv4_peer_with_ipv6_addrMe_test)
     BOOST_CHECK(1);
 }
 
+BOOST_AUTO_TEST_CASE(cnode_receive_checksum)
+{
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+    std::unique_ptr<CNode> pnode = MakeUnique<CNode>(0, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, CAddress{}, std::string{}, false);
+
+    std::vector<unsigned char> payload(1000, 0x42);
+    CMessageHeader hdr(Params().MessageStart(), NetMsgType::PING, payload.size());
+    uint256 hash = Hash(payload.begin(), payload.end());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CDataStream stream(SER_NETWORK, INIT_PROTO_VERSION);
+    stream << hdr;
+    stream.write((const char*)payload.data(), payload.size());
+
+    // Delivered in pieces, the message is hashed as it arrives and accepted
+    bool complete = false;
+    BOOST_CHECK(pnode->ReceiveMsgBytes(stream.data(), 10, complete));
+    BOOST_CHECK(!complete);
+    BOOST_CHECK(pnode->ReceiveMsgBytes(stream.data() + 10, 500, complete));
+    BOOST_CHECK(!complete);
+    BOOST_CHECK(pnode->ReceiveMsgBytes(stream.data() + 510, stream.size() - 510, complete));
+    BOOST_CHECK(complete);
+
+    // A corrupted payload is dropped before it is handed to the message handler
+    stream[stream.size() - 1] ^= 1;
+    BOOST_CHECK(pnode->ReceiveMsgBytes(stream.data(), stream.size(), complete));
+    BOOST_CHECK(!complete);
+}
+
+BOOST_AUTO_TEST_CASE(netmessage_buffer_pool)
+{
+    CNetMessageBufferPool pool;
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), 0U);
+
+    // Fresh buffers are rounded up to their size class
+    CSerializeData buf = pool.Get(300, "tx");
+    BOOST_CHECK_EQUAL(buf.capacity(), 512U);
+    BOOST_CHECK(buf.empty());
+    buf.resize(300);
+    pool.Put(std::move(buf));
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), 512U);
+
+    // ...and handed out again for any request of the same class
+    CSerializeData reused = pool.Get(400, "tx");
+    BOOST_CHECK_EQUAL(reused.capacity(), 512U);
+    BOOST_CHECK(reused.empty());
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), 0U);
+
+    // Unknown commands are counted together
+    CSerializeData other = pool.Get(10, "nosuchcmd");
+    std::map<std::string, CNetMessageBufferPool::Stats> stats = pool.GetStats();
+    BOOST_CHECK_EQUAL(stats["tx"].nAllocated, 1U);
+    BOOST_CHECK_EQUAL(stats["tx"].nReused, 1U);
+    BOOST_CHECK_EQUAL(stats["*other*"].nAllocated, 1U);
+    BOOST_CHECK(stats.find("nosuchcmd") == stats.end());
+
+    // Buffers too large to pool are dropped
+    CSerializeData huge;
+    huge.reserve(4 * 1024 * 1024);
+    pool.Put(std::move(huge));
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), 0U);
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(cnode_send_shared_buffers)
+{
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    CConnman connman(0x1337, 0x1337);
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+    std::unique_ptr<CNode> pnode = MakeUnique<CNode>(0, NODE_NETWORK, 0, fds[0], addr, 0, 0, CAddress{}, std::string{}, false);
+
+    // A shared message keeps a single copy of its payload however often it is queued
+    CSerializedNetMsg msg;
+    msg.command = "block";
+    msg.data.assign(20000, 0x5a);
+    CSharedNetMsg shared(std::move(msg));
+    BOOST_CHECK(shared.header->size() == CMessageHeader::HEADER_SIZE);
+
+    CSerializedNetMsg ping;
+    ping.command = "ping";
+    ping.data.assign(8, 0x01);
+    CSerializedNetMsg ping_copy;
+    ping_copy.command = ping.command;
+    ping_copy.data = ping.data;
+
+    connman.PushMessage(pnode.get(), shared);
+    connman.PushMessage(pnode.get(), std::move(ping));
+    connman.PushMessage(pnode.get(), shared);
+
+    // The socket buffer has room for everything, so each push went out
+    // straight away with the header and payload gathered into one call.
+    BOOST_CHECK(pnode->vSendMsg.empty());
+    std::vector<unsigned char> expected;
+    expected.insert(expected.end(), shared.header->begin(), shared.header->end());
+    expected.insert(expected.end(), shared.data->begin(), shared.data->end());
+    CSharedNetMsg ping_shared(std::move(ping_copy));
+    expected.insert(expected.end(), ping_shared.header->begin(), ping_shared.header->end());
+    expected.insert(expected.end(), ping_shared.data->begin(), ping_shared.data->end());
+    expected.insert(expected.end(), shared.header->begin(), shared.header->end());
+    expected.insert(expected.end(), shared.data->begin(), shared.data->end());
+
+    std::vector<unsigned char> received;
+    unsigned char buf[65536];
+    while (received.size() < expected.size()) {
+        ssize_t n = recv(fds[1], buf, sizeof(buf), 0);
+        BOOST_REQUIRE(n > 0);
+        received.insert(received.end(), buf, buf + n);
+    }
+    BOOST_CHECK(received == expected);
+    BOOST_CHECK_EQUAL(pnode->nSendSize, 0U);
+    BOOST_CHECK_EQUAL(pnode->nSendBytes, expected.size());
+    BOOST_CHECK_EQUAL(shared.data.use_count(), 1);
+    close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(cnode_send_partial_writes)
+{
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    // Keep the socket buffers small so that sends stop part way through a buffer
+    int bufsize = 4096;
+    BOOST_REQUIRE_EQUAL(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize)), 0);
+    BOOST_REQUIRE_EQUAL(setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize)), 0);
+    CConnman connman(0x1337, 0x1337);
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+    std::unique_ptr<CNode> pnode = MakeUnique<CNode>(0, NODE_NETWORK, 0, fds[0], addr, 0, 0, CAddress{}, std::string{}, false);
+
+    CSerializedNetMsg msg;
+    msg.command = "block";
+    msg.data.resize(200000);
+    for (size_t i = 0; i < msg.data.size(); i++) {
+        msg.data[i] = (unsigned char)(i * 7 + i / 251);
+    }
+    CSharedNetMsg shared(std::move(msg));
+
+    CSerializedNetMsg ping;
+    ping.command = "ping";
+    ping.data.assign(8, 0x01);
+    CSerializedNetMsg ping_copy;
+    ping_copy.command = ping.command;
+    ping_copy.data = ping.data;
+    CSharedNetMsg ping_shared(std::move(ping_copy));
+
+    std::vector<unsigned char> expected;
+    for (const CSharedNetMsg* m : {&shared, &ping_shared, &shared}) {
+        expected.insert(expected.end(), m->header->begin(), m->header->end());
+        expected.insert(expected.end(), m->data->begin(), m->data->end());
+    }
+
+    connman.PushMessage(pnode.get(), shared);
+    connman.PushMessage(pnode.get(), std::move(ping));
+    connman.PushMessage(pnode.get(), shared);
+
+    // The first push filled the socket buffer and stopped inside the payload;
+    // the rest waits in the queue, which references the payload rather than
+    // copying it.
+    BOOST_CHECK_EQUAL(pnode->vSendMsg.size(), 5U);
+    BOOST_CHECK(pnode->nSendOffset > 0);
+    BOOST_CHECK_EQUAL(shared.data.use_count(), 3);
+
+    // Drain the receiving end and resume sending, as the socket handler would,
+    // until everything is out.
+    std::vector<unsigned char> received;
+    unsigned char buf[65536];
+    int partial_sends = 0;
+    while (received.size() < expected.size()) {
+        ssize_t n = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT);
+        if (n > 0) {
+            received.insert(received.end(), buf, buf + n);
+        }
+        size_t sent = CConnmanTest::SocketSendData(connman, *pnode);
+        if (sent > 0 && !pnode->vSendMsg.empty()) {
+            ++partial_sends;
+        }
+        BOOST_REQUIRE(n > 0 || sent > 0 || received.size() == expected.size());
+    }
+    BOOST_CHECK(partial_sends > 1);
+    BOOST_CHECK(received == expected);
+    BOOST_CHECK(pnode->vSendMsg.empty());
+    BOOST_CHECK_EQUAL(pnode->nSendOffset, 0U);
+    BOOST_CHECK_EQUAL(pnode->nSendSize, 0U);
+    BOOST_CHECK_EQUAL(pnode->nSendBytes, expected.size());
+    BOOST_CHECK_EQUAL(shared.data.use_count(), 1);
+    close(fds[1]);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
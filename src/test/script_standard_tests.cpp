@@ -743,4 +743,59 @@ BOOST_AUTO_TEST_CASE(script_standard_IsMine)
     }
 }
 
+BOOST_AUTO_TEST_CASE(script_standard_IsMineIndexed)
+{
+    CKey keys[3];
+    CPubKey pubkeys[3];
+    for (int i = 0; i < 3; i++) {
+        keys[i].MakeNewKey(true);
+        pubkeys[i] = keys[i].GetPubKey();
+    }
+
+    CScript multisig = GetScriptForMultisig(2, {pubkeys[0], pubkeys[1]});
+    CScript witness_program = GetScriptForDestination(WitnessV0KeyHash(pubkeys[0].GetID()));
+    std::vector<CScript> scripts = {
+        GetScriptForRawPubKey(pubkeys[0]),
+        GetScriptForDestination(pubkeys[0].GetID()),
+        witness_program,
+        GetScriptForDestination(CScriptID(witness_program)),
+        multisig,
+        GetScriptForDestination(CScriptID(multisig)),
+        GetScriptForDestination(WitnessV0ScriptHash(multisig)),
+        GetScriptForDestination(pubkeys[1].GetID()),
+        GetScriptForDestination(pubkeys[2].GetID()),
+    };
+
+    CBasicKeyStore keystore;
+    auto check_index = [&](int expected_mine) {
+        int mine = 0;
+        for (const CScript& script : scripts) {
+            isminetype result = IsMine(keystore, script);
+            BOOST_CHECK_EQUAL(keystore.IsMineIndexed(script), result);
+            mine += result != ISMINE_NO;
+        }
+        BOOST_CHECK_EQUAL(mine, expected_mine);
+    };
+
+    check_index(0);
+
+    // Every script paying to the key is found.
+    keystore.AddKey(keys[0]);
+    check_index(4);
+
+    // The 2-of-2 script is only ours once the second key is known, which must
+    // invalidate the result cached for it.
+    BOOST_CHECK(keystore.AddCScript(multisig));
+    BOOST_CHECK(keystore.AddCScript(GetScriptForDestination(WitnessV0ScriptHash(multisig))));
+    check_index(4);
+    keystore.AddKey(keys[1]);
+    check_index(7);
+
+    // Watch-only scripts are found until removed.
+    BOOST_CHECK(keystore.AddWatchOnly(scripts.back()));
+    check_index(8);
+    BOOST_CHECK(keystore.RemoveWatchOnly(scripts.back()));
+    check_index(7);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -33,6 +33,12 @@ void CConnmanTest::ClearNodes()
     g_connman->vNodes.clear();
 }
 
+size_t CConnmanTest::SocketSendData(CConnman& connman, CNode& node)
+{
+    LOCK(node.cs_vSend);
+    return connman.SocketSendData(&node);
+}
+
 uint256 insecure_rand_seed = GetRandHash();
 FastRandomContext insecure_rand_ctx(insecure_rand_seed);
 
@@ -60,6 +60,7 @@ class CNode;
 struct CConnmanTest {
     static void AddNode(CNode& node);
     static void ClearNodes();
+    static size_t SocketSendData(CConnman& connman, CNode& node);
 };
 
 class PeerLogicValidation;
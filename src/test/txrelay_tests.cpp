@@ -0,0 +1,89 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <net.h>
+#include <net_processing.h>
+#include <primitives/transaction.h>
+#include <txmempool.h>
+#include <validation.h>
+
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txrelay_tests, TestingSetup)
+
+static NodeId id = 0;
+
+static std::unique_ptr<CNode> MakeTrickleNode(PeerLogicValidation& peerLogic)
+{
+    CAddress addr(CService(CNetAddr(), Params().GetDefaultPort()), NODE_NONE);
+    std::unique_ptr<CNode> node(new CNode(id++, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, CAddress(), "", /*fInboundIn=*/ true));
+    node->SetSendVersion(PROTOCOL_VERSION);
+    peerLogic.InitializeNode(node.get());
+    node->nVersion = 1;
+    node->fSuccessfullyConnected = true;
+    node->fRelayTxes = true;
+    // Whitelisted peers get their inventory on every SendMessages call
+    node->fWhitelisted = true;
+    return node;
+}
+
+static bool Announced(CNode& node, const uint256& hash)
+{
+    LOCK(node.cs_inventory);
+    return node.filterInventoryKnown.contains(hash);
+}
+
+BOOST_AUTO_TEST_CASE(replaced_tx_not_announced)
+{
+    std::unique_ptr<CNode> node1 = MakeTrickleNode(*peerLogic);
+    std::unique_ptr<CNode> node2 = MakeTrickleNode(*peerLogic);
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    mtx.vout[0].nValue = 10 * COIN;
+    CTransactionRef txOriginal = MakeTransactionRef(mtx);
+    mtx.vout[0].nValue = 9 * COIN;
+    CTransactionRef txReplacement = MakeTransactionRef(mtx);
+
+    TestMemPoolEntryHelper entry;
+    mempool.addUnchecked(txOriginal->GetHash(), entry.Fee(1000).FromTx(txOriginal));
+
+    // Announcing to the first peer caches the mempool data of the original
+    node1->PushInventory(CInv(MSG_TX, txOriginal->GetHash()));
+    {
+        LOCK2(cs_main, node1->cs_sendProcessing);
+        peerLogic->SendMessages(node1.get());
+    }
+    BOOST_CHECK(Announced(*node1, txOriginal->GetHash()));
+
+    // Replace it right away, well within the time cached data is reused
+    {
+        LOCK(mempool.cs);
+        mempool.removeRecursive(*txOriginal, MemPoolRemovalReason::REPLACED);
+        mempool.addUnchecked(txReplacement->GetHash(), entry.Fee(2000).FromTx(txReplacement));
+    }
+
+    // The second peer must only hear about the replacement
+    node2->PushInventory(CInv(MSG_TX, txOriginal->GetHash()));
+    node2->PushInventory(CInv(MSG_TX, txReplacement->GetHash()));
+    {
+        LOCK2(cs_main, node2->cs_sendProcessing);
+        peerLogic->SendMessages(node2.get());
+    }
+    BOOST_CHECK(!Announced(*node2, txOriginal->GetHash()));
+    BOOST_CHECK(Announced(*node2, txReplacement->GetHash()));
+
+    bool dummy;
+    peerLogic->FinalizeNode(node1->GetId(), dummy);
+    peerLogic->FinalizeNode(node2->GetId(), dummy);
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
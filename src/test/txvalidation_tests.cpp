@@ -8,6 +8,7 @@
 #include <consensus/validation.h>
 #include <primitives/transaction.h>
 #include <script/script.h>
+#include <script/sign.h>
 #include <test/test_bitcoin.h>
 
 #include <boost/test/unit_test.hpp>
@@ -58,4 +59,74 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_reject_coinbase, TestChain100Setup)
     BOOST_CHECK_EQUAL(nDoS, 100);
 }
 
+/**
+ * Ensure that transactions whose script checks are run on the script-checking
+ * threads are accepted or rejected exactly like serially checked ones.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_parallel_script_checks, TestChain100Setup)
+{
+    BOOST_REQUIRE(nScriptCheckThreads > 0);
+
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const unsigned int num_inputs = MIN_PARALLEL_MEMPOOL_SCRIPT_CHECK_INPUTS * 2;
+
+    auto sign_input = [&](CMutableTransaction& tx, unsigned int n) {
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, tx, n, SIGHASH_ALL, 0, SigVersion::BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        tx.vin[n].scriptSig = CScript() << vchSig;
+    };
+
+    // Split a mature coinbase into enough outputs for a many-input spend
+    CMutableTransaction split;
+    split.nVersion = 1;
+    split.vin.resize(1);
+    split.vin[0].prevout = COutPoint(m_coinbase_txns[0]->GetHash(), 0);
+    split.vout.resize(num_inputs);
+    for (CTxOut& out : split.vout) {
+        out.nValue = 1 * COIN;
+        out.scriptPubKey = scriptPubKey;
+    }
+    sign_input(split, 0);
+
+    LOCK(cs_main);
+
+    CValidationState state;
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(split),
+                nullptr /* pfMissingInputs */, nullptr /* plTxnReplaced */,
+                true /* bypass_limits */, 0 /* nAbsurdFee */));
+
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(num_inputs);
+    for (unsigned int i = 0; i < num_inputs; ++i) {
+        spend.vin[i].prevout = COutPoint(split.GetHash(), i);
+    }
+    spend.vout.resize(1);
+    spend.vout[0].nValue = (num_inputs - 1) * COIN;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    for (unsigned int i = 0; i < num_inputs; ++i) {
+        sign_input(spend, i);
+    }
+
+    // A single bad signature among many inputs must be caught and reported
+    // with the same reason as a serial check would give.
+    CMutableTransaction bad_spend(spend);
+    bad_spend.vin[num_inputs - 1].scriptSig = spend.vin[0].scriptSig;
+    state = CValidationState();
+    BOOST_CHECK(!AcceptToMemoryPool(mempool, state, MakeTransactionRef(bad_spend),
+                nullptr /* pfMissingInputs */, nullptr /* plTxnReplaced */,
+                true /* bypass_limits */, 0 /* nAbsurdFee */));
+    BOOST_CHECK(state.IsInvalid());
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "mandatory-script-verify-flag-failed (Signature must be zero for failed CHECK(MULTI)SIG operation)");
+    BOOST_CHECK(!mempool.exists(bad_spend.GetHash()));
+
+    state = CValidationState();
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(spend),
+                nullptr /* pfMissingInputs */, nullptr /* plTxnReplaced */,
+                true /* bypass_limits */, 0 /* nAbsurdFee */));
+    BOOST_CHECK(mempool.exists(spend.GetHash()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -12,6 +12,7 @@
 #include <policy/coin_age_priority.h>
 #include <policy/policy.h>
 #include <policy/fees.h>
+#include <policy/rbf.h>
 #include <reverse_iterator.h>
 #include <script/script.h>
 #include <streams.h>
@@ -20,13 +21,16 @@
 #include <utilmoneystr.h>
 #include <utiltime.h>
 
+#include <algorithm>
+#include <unordered_map>
+
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
                                  int64_t _nTime, double _entryPriority, unsigned int _entryHeight,
                                  CAmount _inChainInputValue,
                                  bool _spendsCoinbase, int64_t _sigOpsCost, LockPoints lp):
-    tx(_tx), nFee(_nFee), nTime(_nTime), entryPriority(_entryPriority), entryHeight(_entryHeight),
-    inChainInputValue(_inChainInputValue),
-    spendsCoinbase(_spendsCoinbase), sigOpCost(_sigOpsCost), lockPoints(lp)
+    tx(_tx), nFee(_nFee), nTime(_nTime), entryPriority(_entryPriority),
+    inChainInputValue(_inChainInputValue), sigOpCost(_sigOpsCost),
+    entryHeight(_entryHeight), spendsCoinbase(_spendsCoinbase), lockPoints(lp)
 {
     nTxWeight = GetTransactionWeight(*tx);
     nModSize = CalculateModifiedSize(*tx, GetTxSize());
@@ -67,6 +71,35 @@ size_t CTxMemPoolEntry::GetTxSize() const
     return GetVirtualTransactionSize(nTxWeight, sigOpCost);
 }
 
+namespace {
+bool CompareEntryRefByHash(const CTxMemPoolEntryRef& a, const CTxMemPoolEntryRef& b)
+{
+    return a.get().GetTx().GetHash() < b.get().GetTx().GetHash();
+}
+
+/** Insert entry into the sorted links, returning false if it was already there. */
+bool AddLink(CTxMemPoolEntry::Links& links, const CTxMemPoolEntry& entry)
+{
+    auto it = std::lower_bound(links.begin(), links.end(), std::cref(entry), CompareEntryRefByHash);
+    if (it != links.end() && &it->get() == &entry) return false;
+    links.insert(it, std::cref(entry));
+    return true;
+}
+
+/** Remove entry from the sorted links, returning false if it was not there. */
+bool RemoveLink(CTxMemPoolEntry::Links& links, const CTxMemPoolEntry& entry)
+{
+    auto it = std::lower_bound(links.begin(), links.end(), std::cref(entry), CompareEntryRefByHash);
+    if (it == links.end() || &it->get() != &entry) return false;
+    links.erase(it);
+    if (links.empty()) {
+        // Most entries lose all their links eventually; give the memory back
+        CTxMemPoolEntry::Links().swap(links);
+    }
+    return true;
+}
+} // namespace
+
 uint160 ScriptHashkey(const CScript& script)
 {
     uint160 hash;
@@ -80,14 +113,16 @@ uint160 ScriptHashkey(const CScript& script)
 void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendants, const std::set<uint256> &setExclude)
 {
     setEntries stageEntries, setAllDescendants;
-    stageEntries = GetMemPoolChildren(updateIt);
+    for (const CTxMemPoolEntryRef& child : updateIt->GetMemPoolChildrenConst()) {
+        stageEntries.insert(GetIter(child));
+    }
 
     while (!stageEntries.empty()) {
         const txiter cit = *stageEntries.begin();
         setAllDescendants.insert(cit);
         stageEntries.erase(cit);
-        const setEntries &setChildren = GetMemPoolChildren(cit);
-        for (txiter childEntry : setChildren) {
+        for (const CTxMemPoolEntryRef& child : cit->GetMemPoolChildrenConst()) {
+            const txiter childEntry = GetIter(child);
             cacheMap::iterator cacheIt = cachedDescendants.find(childEntry);
             if (cacheIt != cachedDescendants.end()) {
                 // We've already calculated this one, just add the entries for this set
@@ -127,6 +162,7 @@ void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendan
 void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashesToUpdate)
 {
     LOCK(cs);
+    m_snapshot.reset();
     // For each entry in vHashesToUpdate, store the set of in-mempool, but not
     // in-vHashesToUpdate transactions, so that we don't have to recalculate
     // descendants when we come across a previously seen entry.
@@ -189,8 +225,9 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
     } else {
         // If we're not searching for parents, we require this to be an
         // entry in the mempool already.
-        txiter it = mapTx.iterator_to(entry);
-        parentHashes = GetMemPoolParents(it);
+        for (const CTxMemPoolEntryRef& parent : entry.GetMemPoolParentsConst()) {
+            parentHashes.insert(GetIter(parent));
+        }
     }
 
     size_t totalSizeWithAncestors = entry.GetTxSize();
@@ -213,8 +250,8 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
             return false;
         }
 
-        const setEntries & setMemPoolParents = GetMemPoolParents(stageit);
-        for (const txiter &phash : setMemPoolParents) {
+        for (const CTxMemPoolEntryRef& parent : stageit->GetMemPoolParentsConst()) {
+            const txiter phash = GetIter(parent);
             // If this is a new ancestor, add it.
             if (setAncestors.count(phash) == 0) {
                 parentHashes.insert(phash);
@@ -231,10 +268,9 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
 
 void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors)
 {
-    setEntries parentIters = GetMemPoolParents(it);
     // add or remove this tx as a child of each parent
-    for (txiter piter : parentIters) {
-        UpdateChild(piter, it, add);
+    for (const CTxMemPoolEntryRef& parent : it->GetMemPoolParentsConst()) {
+        UpdateChild(GetIter(parent), it, add);
     }
     const int64_t updateCount = (add ? 1 : -1);
     const int64_t updateSize = updateCount * it->GetTxSize();
@@ -260,9 +296,8 @@ void CTxMemPool::UpdateEntryForAncestors(txiter it, const setEntries &setAncesto
 
 void CTxMemPool::UpdateChildrenForRemoval(txiter it)
 {
-    const setEntries &setMemPoolChildren = GetMemPoolChildren(it);
-    for (txiter updateIt : setMemPoolChildren) {
-        UpdateParent(updateIt, it, false);
+    for (const CTxMemPoolEntryRef& child : it->GetMemPoolChildrenConst()) {
+        UpdateParent(GetIter(child), it, false);
     }
 }
 
@@ -271,25 +306,41 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
     // For each entry, walk back all ancestors and decrement size associated with this
     // transaction
     const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    // State changes are accumulated per entry that stays in the mempool, so
+    // that it is modified once no matter how many of its relatives are being
+    // removed. Entries that are being removed themselves need no update.
+    struct PackageStateDelta {
+        int64_t size = 0;
+        CAmount fee = 0;
+        int64_t count = 0;
+        int64_t sigOps = 0;
+    };
     if (updateDescendants) {
         // updateDescendants should be true whenever we're not recursively
         // removing a tx and all its descendants, eg when a transaction is
         // confirmed in a block.
-        // Here we only update statistics and not data in mapLinks (which
+        // Here we only update statistics and not the entries' links (which
         // we need to preserve until we're finished with all operations that
         // need to traverse the mempool).
+        std::map<txiter, PackageStateDelta, CompareIteratorByHash> mapDescendantDeltas;
         for (txiter removeIt : entriesToRemove) {
             setEntries setDescendants;
             CalculateDescendants(removeIt, setDescendants);
-            setDescendants.erase(removeIt); // don't update state for self
-            int64_t modifySize = -((int64_t)removeIt->GetTxSize());
-            CAmount modifyFee = -removeIt->GetModifiedFee();
-            int modifySigOps = -removeIt->GetSigOpCost();
             for (txiter dit : setDescendants) {
-                mapTx.modify(dit, update_ancestor_state(modifySize, modifyFee, -1, modifySigOps));
+                if (entriesToRemove.count(dit)) continue; // also skips self
+                PackageStateDelta& delta = mapDescendantDeltas[dit];
+                delta.size -= removeIt->GetTxSize();
+                delta.fee -= removeIt->GetModifiedFee();
+                delta.count--;
+                delta.sigOps -= removeIt->GetSigOpCost();
             }
         }
+        for (const auto& descendantDelta : mapDescendantDeltas) {
+            const PackageStateDelta& delta = descendantDelta.second;
+            mapTx.modify(descendantDelta.first, update_ancestor_state(delta.size, delta.fee, delta.count, delta.sigOps));
+        }
     }
+    std::map<txiter, PackageStateDelta, CompareIteratorByHash> mapAncestorDeltas;
     for (txiter removeIt : entriesToRemove) {
         setEntries setAncestors;
         const CTxMemPoolEntry &entry = *removeIt;
@@ -300,21 +351,37 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
         // should be a bit faster.
         // However, if we happen to be in the middle of processing a reorg, then
         // the mempool can be in an inconsistent state.  In this case, the set
-        // of ancestors reachable via mapLinks will be the same as the set of
+        // of ancestors reachable via the links will be the same as the set of
         // ancestors whose packages include this transaction, because when we
         // add a new transaction to the mempool in addUnchecked(), we assume it
         // has no children, and in the case of a reorg where that assumption is
         // false, the in-mempool children aren't linked to the in-block tx's
         // until UpdateTransactionsFromBlock() is called.
         // So if we're being called during a reorg, ie before
-        // UpdateTransactionsFromBlock() has been called, then mapLinks[] will
+        // UpdateTransactionsFromBlock() has been called, then the links will
         // differ from the set of mempool parents we'd calculate by searching,
-        // and it's important that we use the mapLinks[] notion of ancestor
+        // and it's important that we use the links' notion of ancestor
         // transactions as the set of things to update for removal.
         CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
-        // Note that UpdateAncestorsOf severs the child links that point to
-        // removeIt in the entries for the parents of removeIt.
-        UpdateAncestorsOf(false, removeIt, setAncestors);
+        for (txiter ancestorIt : setAncestors) {
+            if (entriesToRemove.count(ancestorIt)) continue;
+            PackageStateDelta& delta = mapAncestorDeltas[ancestorIt];
+            delta.size -= removeIt->GetTxSize();
+            delta.fee -= removeIt->GetModifiedFee();
+            delta.count--;
+        }
+        // Sever the child links that point to removeIt in the entries for
+        // the parents of removeIt that are staying.
+        for (const CTxMemPoolEntryRef& parent : removeIt->GetMemPoolParentsConst()) {
+            txiter parentIt = GetIter(parent);
+            if (!entriesToRemove.count(parentIt)) {
+                UpdateChild(parentIt, removeIt, false);
+            }
+        }
+    }
+    for (const auto& ancestorDelta : mapAncestorDeltas) {
+        const PackageStateDelta& delta = ancestorDelta.second;
+        mapTx.modify(ancestorDelta.first, update_descendant_state(delta.size, delta.fee, delta.count));
     }
     // After updating all the ancestor sizes, we can now sever the link between each
     // transaction being removed and any mempool children (ie, update setMemPoolParents
@@ -380,7 +447,6 @@ void CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // Used by AcceptToMemoryPool(), which DOES do
     // all the appropriate checks.
     indexed_transaction_set::iterator newit = mapTx.insert(entry).first;
-    mapLinks.insert(make_pair(newit, TxLinks()));
 
     // Update transaction for any feeDelta created by PrioritiseTransaction
     // TODO: refactor so that the fee delta is calculated before inserting
@@ -422,15 +488,17 @@ void CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     UpdateEntryForAncestors(newit, setAncestors);
 
     nTransactionsUpdated++;
+    m_snapshot.reset();
     totalTxSize += entry.GetTxSize();
     if (minerPolicyEstimator) {minerPolicyEstimator->processTransaction(entry, validFeeEstimate);}
 
-    vTxHashes.emplace_back(tx.GetWitnessHash(), newit);
+    vTxHashes.push_back(tx.GetWitnessHash());
+    vTxHashesEntries.push_back(newit);
     newit->vTxHashesIdx = vTxHashes.size() - 1;
 
-    for (auto& vSPK : entry.mapSPK) {
-        const uint160& SPKKey = vSPK.first;
-        const MemPool_SPK_State& claims = vSPK.second;
+    for (const auto& spk : entry.vSPK) {
+        const uint160& SPKKey = spk.first;
+        const MemPool_SPK_State& claims = spk.second;
         if (claims & MSS_CREATED) {
             mapUsedSPK[SPKKey].first = &tx;
         }
@@ -449,16 +517,22 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
         mapNextTx.erase(txin.prevout);
 
     if (vTxHashes.size() > 1) {
-        vTxHashes[it->vTxHashesIdx] = std::move(vTxHashes.back());
-        vTxHashes[it->vTxHashesIdx].second->vTxHashesIdx = it->vTxHashesIdx;
+        vTxHashes[it->vTxHashesIdx] = vTxHashes.back();
+        vTxHashesEntries[it->vTxHashesIdx] = vTxHashesEntries.back();
+        vTxHashesEntries[it->vTxHashesIdx]->vTxHashesIdx = it->vTxHashesIdx;
         vTxHashes.pop_back();
-        if (vTxHashes.size() * 2 < vTxHashes.capacity())
+        vTxHashesEntries.pop_back();
+        if (vTxHashes.size() * 2 < vTxHashes.capacity()) {
             vTxHashes.shrink_to_fit();
-    } else
+            vTxHashesEntries.shrink_to_fit();
+        }
+    } else {
         vTxHashes.clear();
+        vTxHashesEntries.clear();
+    }
 
-    for (auto& vSPK : it->mapSPK) {
-        const uint160& SPKKey = vSPK.first;
+    for (const auto& spk : it->vSPK) {
+        const uint160& SPKKey = spk.first;
         if (mapUsedSPK[SPKKey].first == &tx) {
             mapUsedSPK[SPKKey].first = NULL;
         }
@@ -472,10 +546,10 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
 
     totalTxSize -= it->GetTxSize();
     cachedInnerUsage -= it->DynamicMemoryUsage();
-    cachedInnerUsage -= memusage::DynamicUsage(mapLinks[it].parents) + memusage::DynamicUsage(mapLinks[it].children);
-    mapLinks.erase(it);
+    cachedInnerUsage -= memusage::DynamicUsage(it->GetMemPoolParentsConst()) + memusage::DynamicUsage(it->GetMemPoolChildrenConst());
     mapTx.erase(it);
     nTransactionsUpdated++;
+    m_snapshot.reset();
     if (minerPolicyEstimator) {minerPolicyEstimator->removeTx(hash, false);}
 }
 
@@ -499,8 +573,8 @@ void CTxMemPool::CalculateDescendants(txiter entryit, setEntries& setDescendants
         setDescendants.insert(it);
         stage.erase(it);
 
-        const setEntries &setChildren = GetMemPoolChildren(it);
-        for (const txiter &childiter : setChildren) {
+        for (const CTxMemPoolEntryRef& child : it->GetMemPoolChildrenConst()) {
+            const txiter childiter = GetIter(child);
             if (!setDescendants.count(childiter)) {
                 stage.insert(childiter);
             }
@@ -601,25 +675,27 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigne
 {
     LOCK(cs);
     std::vector<const CTxMemPoolEntry*> entries;
+    setEntries stage;
     for (const auto& tx : vtx)
     {
         uint256 hash = tx->GetHash();
 
         indexed_transaction_set::iterator i = mapTx.find(hash);
-        if (i != mapTx.end())
+        if (i != mapTx.end()) {
             entries.push_back(&*i);
+            stage.insert(i);
+        }
     }
     // Before the txs in the new block have been removed from the mempool, update policy estimates
     if (minerPolicyEstimator) {minerPolicyEstimator->processBlock(nBlockHeight, entries);}
+    for (const auto& tx : vtx) {
+        UpdateDependentPriorities(*tx, nBlockHeight, true);
+    }
+    // Remove all confirmed transactions in one sweep, so that each remaining
+    // relative has its ancestor and descendant state updated only once.
+    RemoveStaged(stage, true, MemPoolRemovalReason::BLOCK);
     for (const auto& tx : vtx)
     {
-        UpdateDependentPriorities(*tx, nBlockHeight, true);
-        txiter it = mapTx.find(tx->GetHash());
-        if (it != mapTx.end()) {
-            setEntries stage;
-            stage.insert(it);
-            RemoveStaged(stage, true, MemPoolRemovalReason::BLOCK);
-        }
         removeConflicts(*tx);
         ClearPrioritisation(tx->GetHash());
     }
@@ -629,16 +705,18 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigne
 
 void CTxMemPool::_clear()
 {
-    mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
     mapUsedSPK.clear();
+    vTxHashes.clear();
+    vTxHashesEntries.clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = false;
     rollingMinimumFeeRate = 0;
     ++nTransactionsUpdated;
+    m_snapshot.reset();
 }
 
 void CTxMemPool::clear()
@@ -689,10 +767,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         assert(priDiff < .0001 * freshPriority + 1);
         innerUsage += it->DynamicMemoryUsage();
         const CTransaction& tx = it->GetTx();
-        txlinksMap::const_iterator linksiter = mapLinks.find(it);
-        assert(linksiter != mapLinks.end());
-        const TxLinks &links = linksiter->second;
-        innerUsage += memusage::DynamicUsage(links.parents) + memusage::DynamicUsage(links.children);
+        innerUsage += memusage::DynamicUsage(it->GetMemPoolParentsConst()) + memusage::DynamicUsage(it->GetMemPoolChildrenConst());
         bool fDependsWait = false;
         setEntries setParentCheck;
         int64_t parentSizes = 0;
@@ -718,7 +793,11 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             assert(it3->second == &tx);
             i++;
         }
-        assert(setParentCheck == GetMemPoolParents(it));
+        assert(std::is_sorted(it->GetMemPoolParentsConst().begin(), it->GetMemPoolParentsConst().end(), CompareEntryRefByHash));
+        assert(setParentCheck.size() == it->GetMemPoolParentsConst().size());
+        for (const CTxMemPoolEntryRef& parent : it->GetMemPoolParentsConst()) {
+            assert(setParentCheck.count(GetIter(parent)));
+        }
         // Verify ancestor state is correct.
         setEntries setAncestors;
         uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -751,7 +830,11 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 child_sizes += childit->GetTxSize();
             }
         }
-        assert(setChildrenCheck == GetMemPoolChildren(it));
+        assert(std::is_sorted(it->GetMemPoolChildrenConst().begin(), it->GetMemPoolChildrenConst().end(), CompareEntryRefByHash));
+        assert(setChildrenCheck.size() == it->GetMemPoolChildrenConst().size());
+        for (const CTxMemPoolEntryRef& child : it->GetMemPoolChildrenConst()) {
+            assert(setChildrenCheck.count(GetIter(child)));
+        }
         // Also check to make sure size is greater than sum with immediate children.
         // just a sanity check, not definitive that this calc is correct...
         assert(it->GetSizeWithDescendants() >= child_sizes + it->GetTxSize());
@@ -860,7 +943,7 @@ void CTxMemPool::FindScriptPubKey(const std::set<CScript>& needles, std::map<COu
 }
 
 static TxMempoolInfo GetInfo(CTxMemPool::indexed_transaction_set::const_iterator it) {
-    return TxMempoolInfo{it->GetSharedTx(), it->GetTime(), CFeeRate(it->GetFee(), it->GetTxSize()), it->GetModifiedFee() - it->GetFee()};
+    return TxMempoolInfo{it->GetSharedTx(), it->GetTime(), CFeeRate(it->GetFee(), it->GetTxSize()), it->GetModifiedFee() - it->GetFee(), it->GetCountWithAncestors()};
 }
 
 std::vector<TxMempoolInfo> CTxMemPool::infoAll() const
@@ -877,6 +960,60 @@ std::vector<TxMempoolInfo> CTxMemPool::infoAll() const
     return ret;
 }
 
+CTxMemPoolSnapshot::Entry::Entry(const CTxMemPoolEntry& e) :
+    entry(e), wtxid(e.GetTx().GetWitnessHash()), fReplaceable(SignalsOptInRBF(e.GetTx()))
+{
+    vDepends.reserve(e.GetMemPoolParentsConst().size());
+    for (const CTxMemPoolEntry& parent : e.GetMemPoolParentsConst()) {
+        vDepends.push_back(parent.GetTx().GetHash());
+    }
+    vSpentBy.reserve(e.GetMemPoolChildrenConst().size());
+    for (const CTxMemPoolEntry& child : e.GetMemPoolChildrenConst()) {
+        vSpentBy.push_back(child.GetTx().GetHash());
+    }
+    // The links point into the live mempool; the copy must not keep them.
+    entry.ClearLinks();
+}
+
+CTxMemPoolSnapshot::CTxMemPoolSnapshot(const CTxMemPool& pool)
+{
+    AssertLockHeld(pool.cs);
+    vEntries.reserve(pool.mapTx.size());
+    std::unordered_map<const CTxMemPoolEntry*, size_t> mapIndex;
+    mapIndex.reserve(pool.mapTx.size());
+    std::vector<const CTxMemPoolEntry*> vToVisit;
+    for (const CTxMemPoolEntry& e : pool.mapTx) {
+        mapIndex.emplace(&e, vEntries.size());
+        vEntries.emplace_back(e);
+        if (vEntries.back().fReplaceable) vToVisit.push_back(&e);
+    }
+
+    // A transaction is replaceable if any in-mempool ancestor signals, so
+    // propagate the flag from the entries that signal down to their
+    // descendants. Every entry is visited at most once, when it is first
+    // marked.
+    while (!vToVisit.empty()) {
+        const CTxMemPoolEntry* e = vToVisit.back();
+        vToVisit.pop_back();
+        for (const CTxMemPoolEntry& child : e->GetMemPoolChildrenConst()) {
+            Entry& snapshotEntry = vEntries[mapIndex.at(&child)];
+            if (!snapshotEntry.fReplaceable) {
+                snapshotEntry.fReplaceable = true;
+                vToVisit.push_back(&child);
+            }
+        }
+    }
+}
+
+std::shared_ptr<const CTxMemPoolSnapshot> CTxMemPool::GetSnapshot() const
+{
+    LOCK(cs);
+    if (!m_snapshot) {
+        m_snapshot = std::make_shared<const CTxMemPoolSnapshot>(*this);
+    }
+    return m_snapshot;
+}
+
 CTransactionRef CTxMemPool::get(const uint256& hash) const
 {
     LOCK(cs);
@@ -895,6 +1032,18 @@ TxMempoolInfo CTxMemPool::info(const uint256& hash) const
     return GetInfo(i);
 }
 
+std::vector<TxMempoolInfo> CTxMemPool::info(const std::vector<uint256>& hashes) const
+{
+    std::vector<TxMempoolInfo> ret;
+    ret.reserve(hashes.size());
+    LOCK(cs);
+    for (const uint256& hash : hashes) {
+        indexed_transaction_set::const_iterator i = mapTx.find(hash);
+        ret.push_back(i == mapTx.end() ? TxMempoolInfo() : GetInfo(i));
+    }
+    return ret;
+}
+
 void CTxMemPool::PrioritiseTransaction(const uint256& hash, double dPriorityDelta, const CAmount& nFeeDelta)
 {
     {
@@ -921,6 +1070,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256& hash, double dPriorityDelt
                 mapTx.modify(descendantIt, update_ancestor_state(0, nFeeDelta, 0, 0));
             }
             ++nTransactionsUpdated;
+            m_snapshot.reset();
         }
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", hash.ToString(), dPriorityDelta, FormatMoney(nFeeDelta));
@@ -972,7 +1122,7 @@ bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
     // Estimate the overhead of mapTx to be 12 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(vTxHashes) + memusage::DynamicUsage(vTxHashesEntries) + cachedInnerUsage;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants, MemPoolRemovalReason reason) {
@@ -1010,38 +1160,38 @@ void CTxMemPool::addUnchecked(const uint256&hash, const CTxMemPoolEntry &entry,
 
 void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].children.insert(child).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].children.erase(child)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    CTxMemPoolEntry::Links& children = entry->m_children;
+    cachedInnerUsage -= memusage::DynamicUsage(children);
+    if (add) {
+        AddLink(children, *child);
+    } else {
+        RemoveLink(children, *child);
     }
+    cachedInnerUsage += memusage::DynamicUsage(children);
 }
 
 void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].parents.insert(parent).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].parents.erase(parent)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    CTxMemPoolEntry::Links& parents = entry->m_parents;
+    cachedInnerUsage -= memusage::DynamicUsage(parents);
+    if (add) {
+        AddLink(parents, *parent);
+    } else {
+        RemoveLink(parents, *parent);
     }
+    cachedInnerUsage += memusage::DynamicUsage(parents);
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
+const CTxMemPoolEntry::Links& CTxMemPool::GetMemPoolParents(txiter entry) const
 {
     assert (entry != mapTx.end());
-    txlinksMap::const_iterator it = mapLinks.find(entry);
-    assert(it != mapLinks.end());
-    return it->second.parents;
+    return entry->GetMemPoolParentsConst();
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolChildren(txiter entry) const
+const CTxMemPoolEntry::Links& CTxMemPool::GetMemPoolChildren(txiter entry) const
 {
     assert (entry != mapTx.end());
-    txlinksMap::const_iterator it = mapLinks.find(entry);
-    assert(it != mapLinks.end());
-    return it->second.children;
+    return entry->GetMemPoolChildrenConst();
 }
 
 CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const {
@@ -1076,37 +1226,224 @@ void CTxMemPool::trackPackageRemoved(const CFeeRate& rate) {
     }
 }
 
-void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining) {
+size_t CTxMemPool::EstimateEntryUsage(txiter it) const {
+    // Mirrors the per-entry terms of DynamicMemoryUsage(): the entry with its
+    // links, the link back to it in each of its parents, and its spends in
+    // mapNextTx. Shrinking vTxHashes is left out.
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) + it->DynamicMemoryUsage() +
+        2 * memusage::DynamicUsage(it->GetMemPoolParentsConst()) + memusage::DynamicUsage(it->GetMemPoolChildrenConst()) +
+        it->GetTx().vin.size() * memusage::IncrementalDynamicUsage(mapNextTx);
+}
+
+namespace {
+/** The staged descendants of an entry left in the pool during batched trimming */
+struct StagedDescendants {
+    CAmount fee = 0;
+    int64_t size = 0;
+    int64_t count = 0;
+    //! The staged entry and package that last credited this entry
+    uint64_t nLastCredit = 0;
+    uint64_t nLastPackage = 0;
+};
+
+/** The fee and size an entry is ordered by in the descendant_score index,
+ *  after taking away its staged descendants. */
+struct TrimCandidate {
+    CTxMemPool::txiter it;
+    double mod_fee;
+    double size;
+
+    TrimCandidate(CTxMemPool::txiter itIn, const StagedDescendants& staged) : it(itIn)
+    {
+        // As CompareTxMemPoolEntryByDescendantScore::GetModFeeAndSize
+        const CAmount nFeesWithDescendants = it->GetModFeesWithDescendants() - staged.fee;
+        const int64_t nSizeWithDescendants = it->GetSizeWithDescendants() - staged.size;
+        if ((double)nFeesWithDescendants * it->GetTxSize() > (double)it->GetModifiedFee() * nSizeWithDescendants) {
+            mod_fee = nFeesWithDescendants;
+            size = nSizeWithDescendants;
+        } else {
+            mod_fee = it->GetModifiedFee();
+            size = it->GetTxSize();
+        }
+    }
+
+    /** Whether this goes first in descendant_score order */
+    bool Before(const TrimCandidate& other) const
+    {
+        const double f1 = mod_fee * other.size;
+        const double f2 = size * other.mod_fee;
+        if (f1 == f2) return it->GetTime() >= other.it->GetTime();
+        return f1 < f2;
+    }
+};
+
+struct CompareTrimCandidate {
+    bool operator()(const TrimCandidate& a, const TrimCandidate& b) const
+    {
+        if (a.Before(b) != b.Before(a)) return a.Before(b);
+        return &*a.it < &*b.it;
+    }
+};
+} // namespace
+
+void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining, bool fBatched) {
     LOCK(cs);
 
     unsigned nTxnRemoved = 0;
     CFeeRate maxFeeRateRemoved(0);
     while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
-        indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().begin();
+        const size_t nExcess = DynamicMemoryUsage() - sizelimit;
+        size_t nStagedUsage = 0;
+        setEntries stage;
+        // In batched mode, entries left in the pool above something staged
+        // this round have a stale position in descendant_score: removing their
+        // staged descendants will raise or lower their score. They are taken
+        // out of the index order and picked by their updated score instead.
+        // The same tally of staged descendants updates their state when the
+        // round is removed.
+        std::unordered_map<const CTxMemPoolEntry*, StagedDescendants> mapStagedDescendants;
+        std::set<TrimCandidate, CompareTrimCandidate> setRescored;
+        uint64_t nCredits = 0;
+        uint64_t nPackages = 0;
+        auto indexIt = mapTx.get<descendant_score>().begin();
+        while (true) {
+            while (indexIt != mapTx.get<descendant_score>().end() &&
+                   (mapStagedDescendants.count(&*indexIt) || stage.count(mapTx.project<0>(indexIt)))) {
+                ++indexIt;
+            }
+            txiter root;
+            CAmount nPackageFees;
+            int64_t nPackageSize;
+            if (!setRescored.empty() && (indexIt == mapTx.get<descendant_score>().end() ||
+                                         setRescored.begin()->Before(TrimCandidate(mapTx.project<0>(indexIt), StagedDescendants())))) {
+                root = setRescored.begin()->it;
+                setRescored.erase(setRescored.begin());
+                auto staged = mapStagedDescendants.find(&*root);
+                nPackageFees = root->GetModFeesWithDescendants() - staged->second.fee;
+                nPackageSize = root->GetSizeWithDescendants() - staged->second.size;
+                mapStagedDescendants.erase(staged);
+            } else if (indexIt != mapTx.get<descendant_score>().end()) {
+                root = mapTx.project<0>(indexIt);
+                nPackageFees = root->GetModFeesWithDescendants();
+                nPackageSize = root->GetSizeWithDescendants();
+                ++indexIt;
+            } else {
+                break;
+            }
 
-        // We set the new mempool min fee to the feerate of the removed set, plus the
-        // "minimum reasonable fee rate" (ie some value under which we consider txn
-        // to have 0 fee). This way, we don't allow txn to enter mempool with feerate
-        // equal to txn which were removed with no block in between.
-        CFeeRate removed(it->GetModFeesWithDescendants(), it->GetSizeWithDescendants());
-        removed += incrementalRelayFee;
-        trackPackageRemoved(removed);
-        maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
+            // We set the new mempool min fee to the feerate of the removed set, plus the
+            // "minimum reasonable fee rate" (ie some value under which we consider txn
+            // to have 0 fee). This way, we don't allow txn to enter mempool with feerate
+            // equal to txn which were removed with no block in between.
+            CFeeRate removed(nPackageFees, nPackageSize);
+            removed += incrementalRelayFee;
+            trackPackageRemoved(removed);
+            maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
+
+            // Stage the package. The stage is always closed under descendants,
+            // so there is no need to walk below an entry that is already in it.
+            std::vector<txiter> vToVisit{root};
+            std::vector<txiter> vPackage;
+            stage.insert(root);
+            while (!vToVisit.empty()) {
+                txiter packageIt = vToVisit.back();
+                vToVisit.pop_back();
+                vPackage.push_back(packageIt);
+                nStagedUsage += EstimateEntryUsage(packageIt);
+                auto staged = mapStagedDescendants.find(&*packageIt);
+                if (staged != mapStagedDescendants.end()) {
+                    setRescored.erase(TrimCandidate(packageIt, staged->second));
+                    mapStagedDescendants.erase(staged);
+                }
+                for (const CTxMemPoolEntry& child : packageIt->GetMemPoolChildrenConst()) {
+                    txiter childIt = mapTx.iterator_to(child);
+                    if (stage.insert(childIt).second) vToVisit.push_back(childIt);
+                }
+            }
+            if (!fBatched) break;
+
+            // Credit every staged entry to each of its ancestors left in the
+            // pool, and move those to their updated place in the pick order.
+            // Ancestors are marked with the entry that last credited them, so
+            // each is walked once per entry, and with the package, so each is
+            // moved once per package.
+            nPackages++;
+            std::vector<txiter> vToRescore;
+            for (txiter packageIt : vPackage) {
+                nCredits++;
+                setEntries setStagedVisited;
+                vToVisit.assign(1, packageIt);
+                while (!vToVisit.empty()) {
+                    txiter visitIt = vToVisit.back();
+                    vToVisit.pop_back();
+                    for (const CTxMemPoolEntry& parent : visitIt->GetMemPoolParentsConst()) {
+                        txiter parentIt = mapTx.iterator_to(parent);
+                        auto staged = mapStagedDescendants.find(&parent);
+                        if (staged == mapStagedDescendants.end()) {
+                            if (stage.count(parentIt)) {
+                                // Staged in this same package; walk through it
+                                if (setStagedVisited.insert(parentIt).second) vToVisit.push_back(parentIt);
+                                continue;
+                            }
+                            staged = mapStagedDescendants.emplace(&parent, StagedDescendants()).first;
+                        }
+                        StagedDescendants& tally = staged->second;
+                        if (tally.nLastCredit == nCredits) continue;
+                        tally.nLastCredit = nCredits;
+                        if (tally.nLastPackage != nPackages) {
+                            if (tally.count) setRescored.erase(TrimCandidate(parentIt, tally));
+                            tally.nLastPackage = nPackages;
+                            vToRescore.push_back(parentIt);
+                        }
+                        tally.fee += packageIt->GetModifiedFee();
+                        tally.size += packageIt->GetTxSize();
+                        tally.count++;
+                        vToVisit.push_back(parentIt);
+                    }
+                }
+            }
+            for (txiter rescoreIt : vToRescore) {
+                setRescored.emplace(rescoreIt, mapStagedDescendants[&*rescoreIt]);
+            }
 
-        setEntries stage;
-        CalculateDescendants(mapTx.project<0>(it), stage);
+            // Keep selecting packages until the estimated usage of everything
+            // staged covers the excess; if the estimate falls short, the outer
+            // loop runs another round.
+            if (nStagedUsage >= nExcess) break;
+        }
         nTxnRemoved += stage.size();
 
-        std::vector<CTransaction> txn;
+        std::vector<CTransactionRef> txn;
         if (pvNoSpendsRemaining) {
             txn.reserve(stage.size());
             for (txiter iter : stage)
-                txn.push_back(iter->GetTx());
+                txn.push_back(iter->GetSharedTx());
+        }
+        if (fBatched) {
+            // Every entry left in the pool with a staged descendant has its
+            // tally in mapStagedDescendants, which saves RemoveStaged from
+            // walking the ancestors of each staged entry again.
+            for (const auto& staged : mapStagedDescendants) {
+                txiter ancestorIt = mapTx.iterator_to(*staged.first);
+                mapTx.modify(ancestorIt, update_descendant_state(-staged.second.size, -staged.second.fee, -staged.second.count));
+                std::vector<txiter> vStagedChildren;
+                for (const CTxMemPoolEntry& child : ancestorIt->GetMemPoolChildrenConst()) {
+                    txiter childIt = mapTx.iterator_to(child);
+                    if (stage.count(childIt)) vStagedChildren.push_back(childIt);
+                }
+                for (txiter childIt : vStagedChildren) {
+                    UpdateChild(ancestorIt, childIt, false);
+                }
+            }
+            for (txiter it : stage) {
+                removeUnchecked(it, MemPoolRemovalReason::SIZELIMIT);
+            }
+        } else {
+            RemoveStaged(stage, false, MemPoolRemovalReason::SIZELIMIT);
         }
-        RemoveStaged(stage, false, MemPoolRemovalReason::SIZELIMIT);
         if (pvNoSpendsRemaining) {
-            for (const CTransaction& tx : txn) {
-                for (const CTxIn& txin : tx.vin) {
+            for (const CTransactionRef& tx : txn) {
+                for (const CTxIn& txin : tx->vin) {
                     if (exists(txin.prevout.hash)) continue;
                     pvNoSpendsRemaining->push_back(txin.prevout);
                 }
@@ -1129,12 +1466,12 @@ uint64_t CTxMemPool::CalculateDescendantMaximum(txiter entry) const {
         txiter candidate = candidates.back();
         candidates.pop_back();
         if (!counted.insert(candidate).second) continue;
-        const setEntries& parents = GetMemPoolParents(candidate);
+        const CTxMemPoolEntry::Links& parents = candidate->GetMemPoolParentsConst();
         if (parents.size() == 0) {
             maximum = std::max(maximum, candidate->GetCountWithDescendants());
         } else {
-            for (txiter i : parents) {
-                candidates.push_back(i);
+            for (const CTxMemPoolEntryRef& i : parents) {
+                candidates.push_back(GetIter(i));
             }
         }
     }
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <functional>
 #include <memory>
 #include <set>
 #include <map>
@@ -62,8 +63,13 @@ enum MemPool_SPK_State {
 };
 
 typedef std::map<uint160, enum MemPool_SPK_State> SPKStates_t;
+//! Flat copy of an SPKStates_t, as kept by each mempool entry
+typedef std::vector<std::pair<uint160, enum MemPool_SPK_State>> SPKStatesVector_t;
 
 class CTxMemPool;
+class CTxMemPoolEntry;
+
+typedef std::reference_wrapper<const CTxMemPoolEntry> CTxMemPoolEntryRef;
 
 /** \class CTxMemPoolEntry
  *
@@ -75,25 +81,36 @@ class CTxMemPool;
  * (nCountWithDescendants, nSizeWithDescendants, and nModFeesWithDescendants) for
  * all ancestors of the newly added transaction.
  *
+ * The entry also holds its in-mempool parents and children directly, as flat
+ * vectors sorted by txid; these are maintained by CTxMemPool.
+ *
  */
 
 class CTxMemPoolEntry
 {
+    // The parent and child links are only changed by CTxMemPool::UpdateParent
+    // and CTxMemPool::UpdateChild.
+    friend class CTxMemPool;
+
+public:
+    typedef std::vector<CTxMemPoolEntryRef> Links;
+
 private:
     CTransactionRef tx;
+    mutable Links m_parents;   //!< In-mempool parents, sorted by txid
+    mutable Links m_children;  //!< In-mempool children, sorted by txid
     CAmount nFee;              //!< Cached to avoid expensive parent-transaction lookups
-    size_t nTxWeight;          //!< ... and avoid recomputing tx weight (also used for GetTxSize())
-    size_t nModSize;           //!< ... and modified size for priority
     size_t nUsageSize;         //!< ... and total memory usage
     int64_t nTime;             //!< Local time when entering the mempool
     double entryPriority;      //!< Priority when entering the mempool
-    unsigned int entryHeight;  //!< Chain height when entering the mempool
     double cachedPriority;     //!< Last calculated priority
-    unsigned int cachedHeight; //!< Height at which priority was last calculated
     CAmount inChainInputValue; //!< Sum of all txin values that are already in blockchain
-    bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
     int64_t sigOpCost;         //!< Total sigop cost
     int64_t feeDelta;          //!< Used for determining the priority of the transaction for mining in a block
+    int32_t nTxWeight;         //!< ... and avoid recomputing tx weight (also used for GetTxSize())
+    uint32_t nModSize;         //!< ... and modified size for priority
+    unsigned int entryHeight;  //!< Chain height when entering the mempool
+    unsigned int cachedHeight; //!< Height at which priority was last calculated
     LockPoints lockPoints;     //!< Track the height and time at which tx was final
 
     // Information about descendants of this transaction that are in the
@@ -109,6 +126,8 @@ private:
     CAmount nModFeesWithAncestors;
     int64_t nSigOpCostWithAncestors;
 
+    bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
+
 public:
     CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
                     int64_t _nTime, double _entryPriority, unsigned int _entryHeight,
@@ -159,9 +178,14 @@ public:
     CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
     int64_t GetSigOpCostWithAncestors() const { return nSigOpCostWithAncestors; }
 
-    mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+    const Links& GetMemPoolParentsConst() const { return m_parents; }
+    const Links& GetMemPoolChildrenConst() const { return m_children; }
+    //! Drop the links, for a copy of the entry that lives outside the mempool
+    void ClearLinks() { Links().swap(m_parents); Links().swap(m_children); }
+
+    mutable uint32_t vTxHashesIdx; //!< Index in mempool's vTxHashes
 
-    SPKStates_t mapSPK;
+    SPKStatesVector_t vSPK;    //!< scriptPubKeys created/spent by this tx (see mapUsedSPK; like it, not counted in memory usage)
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -372,6 +396,41 @@ struct TxMempoolInfo
 
     /** The fee delta. */
     int64_t nFeeDelta;
+
+    /** Number of in-mempool ancestors, including the transaction itself. */
+    uint64_t nCountWithAncestors;
+};
+
+/**
+ * Immutable copy of the mempool contents, for read-only consumers that walk
+ * the whole pool (getrawmempool verbose, /rest/mempool/contents). It is
+ * built under the mempool lock and shared by reference count, so rendering
+ * it does not block transaction acceptance.
+ */
+class CTxMemPoolSnapshot
+{
+public:
+    struct Entry
+    {
+        explicit Entry(const CTxMemPoolEntry& e);
+
+        /** Copy of the mempool entry, without its links to other entries */
+        CTxMemPoolEntry entry;
+        uint256 wtxid;
+        /** Txids of the in-mempool parents and children */
+        std::vector<uint256> vDepends;
+        std::vector<uint256> vSpentBy;
+        /** Whether the tx or any in-mempool ancestor signals BIP125 */
+        bool fReplaceable;
+    };
+
+    explicit CTxMemPoolSnapshot(const CTxMemPool& pool);
+
+    /** Entries in the iteration order of the mempool's txid index */
+    const std::vector<Entry>& GetEntries() const { return vEntries; }
+
+private:
+    std::vector<Entry> vEntries;
 };
 
 /** Reason why a transaction was removed from the mempool,
@@ -427,9 +486,9 @@ public:
  * transaction depends on.
  *
  * In order for the feerate sort to remain correct, we must update transactions
- * in the mempool when new descendants arrive.  To facilitate this, we track
- * the set of in-mempool direct parents and direct children in mapLinks.  Within
- * each CTxMemPoolEntry, we track the size and fees of all descendants.
+ * in the mempool when new descendants arrive.  To facilitate this, each
+ * CTxMemPoolEntry tracks its in-mempool direct parents and direct children, as
+ * well as the size and fees of all descendants.
  *
  * Usually when a new transaction is added to the mempool, it has no in-mempool
  * children (because any such children would be an orphan).  So in
@@ -461,7 +520,7 @@ public:
  * state, to account for in-mempool, out-of-block descendants for all the
  * in-block transactions by calling UpdateTransactionsFromBlock().  Note that
  * until this is called, the mempool state is not consistent, and in particular
- * mapLinks may not be correct (and therefore functions like
+ * the entries' parent/child links may not be correct (and therefore functions like
  * CalculateMemPoolAncestors() and CalculateDescendants() that rely
  * on them to walk the mempool are not generally safe to use).
  *
@@ -486,6 +545,7 @@ private:
     mutable int64_t lastRollingFeeUpdate;
     mutable bool blockSinceLastRollingFeeBump;
     mutable double rollingMinimumFeeRate; //!< minimum fee to get into the pool, decreases exponentially
+    mutable std::shared_ptr<const CTxMemPoolSnapshot> m_snapshot GUARDED_BY(cs); //!< Cached result of GetSnapshot(), reset on changes
 
     void trackPackageRemoved(const CFeeRate& rate) EXCLUSIVE_LOCKS_REQUIRED(cs);
 
@@ -523,7 +583,8 @@ public:
     indexed_transaction_set mapTx GUARDED_BY(cs);
 
     using txiter = indexed_transaction_set::nth_index<0>::type::const_iterator;
-    std::vector<std::pair<uint256, txiter> > vTxHashes; //!< All tx witness hashes/entries in mapTx, in random order
+    std::vector<uint256> vTxHashes; //!< All tx witness hashes in mapTx, in random order, kept contiguous for fast scanning
+    std::vector<txiter> vTxHashesEntries; //!< The mapTx entries of vTxHashes, index for index
 
     struct CompareIteratorByHash {
         bool operator()(const txiter &a, const txiter &b) const {
@@ -532,23 +593,18 @@ public:
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
 
-    const setEntries & GetMemPoolParents(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
-    const setEntries & GetMemPoolChildren(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+    const CTxMemPoolEntry::Links& GetMemPoolParents(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+    const CTxMemPoolEntry::Links& GetMemPoolChildren(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
     uint64_t CalculateDescendantMaximum(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
 
+    /** Get the mapTx iterator for an entry referenced from another entry's parents/children */
+    txiter GetIter(const CTxMemPoolEntryRef& entry) const EXCLUSIVE_LOCKS_REQUIRED(cs) { return mapTx.iterator_to(entry.get()); }
+
     std::map<uint160, std::pair<const CTransaction *, const CTransaction *>> mapUsedSPK;
 
 private:
     typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
 
-    struct TxLinks {
-        setEntries parents;
-        setEntries children;
-    };
-
-    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
-    txlinksMap mapLinks;
-
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
 
@@ -639,7 +695,7 @@ public:
      *  limitDescendantSize = max size of descendants any ancestor can have
      *  errString = populated with error reason if any limits are hit
      *  fSearchForParents = whether to search a tx's vin for in-mempool parents, or
-     *    look up parents from mapLinks. Must be true for entries not in the mempool
+     *    look up parents from the entry's links. Must be true for entries not in the mempool
      */
     bool CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string& errString, bool fSearchForParents = true) const EXCLUSIVE_LOCKS_REQUIRED(cs);
 
@@ -675,8 +731,14 @@ public:
     /** Remove transactions from the mempool until its dynamic size is <= sizelimit.
       *  pvNoSpendsRemaining, if set, will be populated with the list of outpoints
       *  which are not in mempool which no longer have any spends in this mempool.
+      *  If fBatched is set, packages are selected in rounds and each round is
+      *  removed in a single pass. Within a round, ancestors of the packages
+      *  selected so far are picked by the descendant score they will have once
+      *  those are gone, so packages are selected in the same order as without
+      *  batching, and the same tally of their staged descendants updates their
+      *  state on removal.
       */
-    void TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining=nullptr);
+    void TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining=nullptr, bool fBatched=false);
 
     /** Expire all transaction (and their dependencies) in the mempool older than time. Return the number of removed transactions. */
     int Expire(int64_t time);
@@ -707,7 +769,14 @@ public:
 
     CTransactionRef get(const uint256& hash) const;
     TxMempoolInfo info(const uint256& hash) const;
+    /** Look up many transactions under a single lock; missing ones get a null tx. */
+    std::vector<TxMempoolInfo> info(const std::vector<uint256>& hashes) const;
     std::vector<TxMempoolInfo> infoAll() const;
+    /**
+     * Return a snapshot of the current mempool contents. The snapshot is
+     * cached until the mempool changes, so repeated calls are cheap.
+     */
+    std::shared_ptr<const CTxMemPoolSnapshot> GetSnapshot() const;
 
     void FindScriptPubKey(const std::set<CScript>& needles, std::map<COutPoint, Coin>& out_results);
 
@@ -741,6 +810,8 @@ private:
       * If updateDescendants is true, then also update in-mempool descendants'
       * ancestor state. */
     void UpdateForRemoveFromMempool(const setEntries &entriesToRemove, bool updateDescendants) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /** Estimate how much DynamicMemoryUsage() drops when removing one entry. */
+    size_t EstimateEntryUsage(txiter it) const EXCLUSIVE_LOCKS_REQUIRED(cs);
     /** Sever link between specified transaction and direct children. */
     void UpdateChildrenForRemoval(txiter entry) EXCLUSIVE_LOCKS_REQUIRED(cs);
 
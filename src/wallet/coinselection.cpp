@@ -33,11 +33,13 @@ struct {
  *
  * waste = selectionTotal - target + inputs × (currentFeeRate - longTermFeeRate)
  *
- * The algorithm uses two additional optimizations. A lookahead keeps track of the total value of
+ * The algorithm uses three additional optimizations. A lookahead keeps track of the total value of
  * the unexplored UTXOs. A subtree is not explored if the lookahead indicates that the target range
  * cannot be reached. Further, it is unnecessary to test equivalent combinations. This allows us
  * to skip testing the inclusion of UTXOs that match the effective value and waste of an omitted
- * predecessor.
+ * predecessor. Finally, UTXOs whose inclusion would exceed the target range are omitted all at
+ * once: as the UTXOs are sorted, the first one that fits is found by binary search, so on large
+ * pools the search does not spend its tries stepping over UTXOs that are too large one at a time.
  *
  * The Branch and Bound algorithm is described in detail in Murch's Master Thesis:
  * https://murch.one/wp-content/uploads/2016/11/erhardt2016coinselection.pdf
@@ -82,6 +84,12 @@ bool SelectCoinsBnB(std::vector<OutputGroup>& utxo_pool, const CAmount& target_v
     // Sort the utxo_pool
     std::sort(utxo_pool.begin(), utxo_pool.end(), descending);
 
+    // Precompute the total value of the utxos from each index onwards for the lookahead
+    std::vector<CAmount> remaining_value(utxo_pool.size() + 1, 0);
+    for (size_t i = utxo_pool.size(); i > 0; --i) {
+        remaining_value[i - 1] = remaining_value[i] + utxo_pool[i - 1].effective_value;
+    }
+
     CAmount curr_waste = 0;
     std::vector<bool> best_selection;
     CAmount best_waste = MAX_MONEY;
@@ -90,7 +98,7 @@ bool SelectCoinsBnB(std::vector<OutputGroup>& utxo_pool, const CAmount& target_v
     for (size_t i = 0; i < TOTAL_TRIES; ++i) {
         // Conditions for starting a backtrack
         bool backtrack = false;
-        if (curr_value + curr_available_value < actual_target ||                // Cannot possibly reach target with the amount remaining in the curr_available_value.
+        if (curr_value + remaining_value[curr_selection.size()] < actual_target || // Cannot possibly reach target with the amount remaining in the unexplored utxos.
             curr_value > actual_target + cost_of_change ||    // Selected value is out of range, go back and try other branch
             (curr_waste > best_waste && (utxo_pool.at(0).fee - utxo_pool.at(0).long_term_fee) > 0)) { // Don't select things which we know will be more wasteful if the waste is increasing
             backtrack = true;
@@ -114,7 +122,6 @@ bool SelectCoinsBnB(std::vector<OutputGroup>& utxo_pool, const CAmount& target_v
             // Walk backwards to find the last included UTXO that still needs to have its omission branch traversed.
             while (!curr_selection.empty() && !curr_selection.back()) {
                 curr_selection.pop_back();
-                curr_available_value += utxo_pool.at(curr_selection.size()).effective_value;
             }
 
             if (curr_selection.empty()) { // We have walked back to the first utxo and no branch is untraversed. All solutions searched
@@ -127,10 +134,16 @@ bool SelectCoinsBnB(std::vector<OutputGroup>& utxo_pool, const CAmount& target_v
             curr_value -= utxo.effective_value;
             curr_waste -= utxo.fee - utxo.long_term_fee;
         } else { // Moving forwards, continuing down this branch
-            OutputGroup& utxo = utxo_pool.at(curr_selection.size());
-
-            // Remove this utxo from the curr_available_value utxo amount
-            curr_available_value -= utxo.effective_value;
+            // Omit the utxos that would take the selection out of range all at once. As the utxo_pool
+            // is sorted, these are the ones before the first that fits.
+            const CAmount max_value = actual_target + cost_of_change - curr_value;
+            const auto first_fit = std::partition_point(utxo_pool.begin() + curr_selection.size(), utxo_pool.end(),
+                [max_value](const OutputGroup& utxo) { return utxo.effective_value > max_value; });
+            curr_selection.resize(first_fit - utxo_pool.begin(), false);
+            if (first_fit == utxo_pool.end()) {
+                continue;
+            }
+            OutputGroup& utxo = *first_fit;
 
             // Avoid searching a branch if the previous UTXO has the same value and same waste and was excluded. Since the ratio of fee to
             // long term fee is the same, we only need to check if one of those values match in order to know that the waste is the same.
@@ -164,24 +177,41 @@ bool SelectCoinsBnB(std::vector<OutputGroup>& utxo_pool, const CAmount& target_v
     return true;
 }
 
-static void ApproximateBestSubset(const std::vector<OutputGroup>& groups, const CAmount& nTotalLower, const CAmount& nTargetValue,
+//! Bound on the number of groups ApproximateBestSubset visits in its first pass over all of its
+//! iterations. On very large pools it runs fewer iterations instead of taking longer; pools of up
+//! to 1000 groups still get all 1000 iterations.
+static const size_t APPROXIMATE_BEST_SUBSET_MAX_VISITS = 1000 * 1000;
+
+static void ApproximateBestSubset(const std::vector<CAmount>& values, const CAmount& nTotalLower, const CAmount& nTargetValue,
                                   std::vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
 {
     std::vector<char> vfIncluded;
+    // Indices kept in the selection of the current iteration, in order of inclusion. A better
+    // selection is recorded as a prefix of these plus one more index, and only copied into
+    // vfBest at the end of the iteration, rather than copying vfIncluded on every improvement.
+    std::vector<unsigned int> included;
 
-    vfBest.assign(groups.size(), true);
+    vfBest.assign(values.size(), true);
     nBest = nTotalLower;
 
+    if (!values.empty()) {
+        iterations = std::max<int>(1, std::min<size_t>(iterations, APPROXIMATE_BEST_SUBSET_MAX_VISITS / values.size()));
+    }
+
     FastRandomContext insecure_rand;
 
     for (int nRep = 0; nRep < iterations && nBest != nTargetValue; nRep++)
     {
-        vfIncluded.assign(groups.size(), false);
+        vfIncluded.assign(values.size(), false);
+        included.clear();
         CAmount nTotal = 0;
         bool fReachedTarget = false;
+        bool fImproved = false;
+        size_t best_prefix = 0;
+        unsigned int best_last = 0;
         for (int nPass = 0; nPass < 2 && !fReachedTarget; nPass++)
         {
-            for (unsigned int i = 0; i < groups.size(); i++)
+            for (unsigned int i = 0; i < values.size(); i++)
             {
                 //The solver here uses a randomized algorithm,
                 //the randomness serves no real security purpose but is just
@@ -191,7 +221,7 @@ static void ApproximateBestSubset(const std::vector<OutputGroup>& groups, const
                 //the selection random.
                 if (nPass == 0 ? insecure_rand.randbool() : !vfIncluded[i])
                 {
-                    nTotal += groups[i].m_value;
+                    nTotal += values[i];
                     vfIncluded[i] = true;
                     if (nTotal >= nTargetValue)
                     {
@@ -199,14 +229,25 @@ static void ApproximateBestSubset(const std::vector<OutputGroup>& groups, const
                         if (nTotal < nBest)
                         {
                             nBest = nTotal;
-                            vfBest = vfIncluded;
+                            fImproved = true;
+                            best_prefix = included.size();
+                            best_last = i;
                         }
-                        nTotal -= groups[i].m_value;
+                        nTotal -= values[i];
                         vfIncluded[i] = false;
+                    } else {
+                        included.push_back(i);
                     }
                 }
             }
         }
+        if (fImproved) {
+            vfBest.assign(values.size(), false);
+            for (size_t j = 0; j < best_prefix; j++) {
+                vfBest[included[j]] = true;
+            }
+            vfBest[best_last] = true;
+        }
     }
 }
 
@@ -215,30 +256,37 @@ bool KnapsackSolver(const CAmount& nTargetValue, std::vector<OutputGroup>& group
     setCoinsRet.clear();
     nValueRet = 0;
 
-    // List of values less than target
-    boost::optional<OutputGroup> lowest_larger;
-    std::vector<OutputGroup> applicable_groups;
+    // List of values less than target. Groups are handled by pointer, as copying and moving
+    // them around costs more than the selection itself on large pools.
+    const OutputGroup* lowest_larger = nullptr;
+    std::vector<const OutputGroup*> applicable_groups;
     CAmount nTotalLower = 0;
 
-    random_shuffle(groups.begin(), groups.end(), GetRandInt);
-
+    std::vector<const OutputGroup*> shuffled_groups;
+    shuffled_groups.reserve(groups.size());
     for (const OutputGroup& group : groups) {
-        if (group.m_value == nTargetValue) {
-            util::insert(setCoinsRet, group.m_outputs);
-            nValueRet += group.m_value;
+        shuffled_groups.push_back(&group);
+    }
+    FastRandomContext insecure_rand;
+    std::shuffle(shuffled_groups.begin(), shuffled_groups.end(), insecure_rand);
+
+    for (const OutputGroup* group : shuffled_groups) {
+        if (group->m_value == nTargetValue) {
+            util::insert(setCoinsRet, group->m_outputs);
+            nValueRet += group->m_value;
             return true;
-        } else if (group.m_value < nTargetValue + MIN_CHANGE) {
+        } else if (group->m_value < nTargetValue + MIN_CHANGE) {
             applicable_groups.push_back(group);
-            nTotalLower += group.m_value;
-        } else if (!lowest_larger || group.m_value < lowest_larger->m_value) {
+            nTotalLower += group->m_value;
+        } else if (!lowest_larger || group->m_value < lowest_larger->m_value) {
             lowest_larger = group;
         }
     }
 
     if (nTotalLower == nTargetValue) {
-        for (const auto& group : applicable_groups) {
-            util::insert(setCoinsRet, group.m_outputs);
-            nValueRet += group.m_value;
+        for (const OutputGroup* group : applicable_groups) {
+            util::insert(setCoinsRet, group->m_outputs);
+            nValueRet += group->m_value;
         }
         return true;
     }
@@ -251,13 +299,18 @@ bool KnapsackSolver(const CAmount& nTargetValue, std::vector<OutputGroup>& group
     }
 
     // Solve subset sum by stochastic approximation
-    std::sort(applicable_groups.begin(), applicable_groups.end(), descending);
+    std::sort(applicable_groups.begin(), applicable_groups.end(), [](const OutputGroup* a, const OutputGroup* b) { return descending(*a, *b); });
+    std::vector<CAmount> applicable_values;
+    applicable_values.reserve(applicable_groups.size());
+    for (const OutputGroup* group : applicable_groups) {
+        applicable_values.push_back(group->m_value);
+    }
     std::vector<char> vfBest;
     CAmount nBest;
 
-    ApproximateBestSubset(applicable_groups, nTotalLower, nTargetValue, vfBest, nBest);
+    ApproximateBestSubset(applicable_values, nTotalLower, nTargetValue, vfBest, nBest);
     if (nBest != nTargetValue && nTotalLower >= nTargetValue + MIN_CHANGE) {
-        ApproximateBestSubset(applicable_groups, nTotalLower, nTargetValue + MIN_CHANGE, vfBest, nBest);
+        ApproximateBestSubset(applicable_values, nTotalLower, nTargetValue + MIN_CHANGE, vfBest, nBest);
     }
 
     // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
@@ -269,8 +322,8 @@ bool KnapsackSolver(const CAmount& nTargetValue, std::vector<OutputGroup>& group
     } else {
         for (unsigned int i = 0; i < applicable_groups.size(); i++) {
             if (vfBest[i]) {
-                util::insert(setCoinsRet, applicable_groups[i].m_outputs);
-                nValueRet += applicable_groups[i].m_value;
+                util::insert(setCoinsRet, applicable_groups[i]->m_outputs);
+                nValueRet += applicable_groups[i]->m_value;
             }
         }
 
@@ -278,7 +331,7 @@ bool KnapsackSolver(const CAmount& nTargetValue, std::vector<OutputGroup>& group
             LogPrint(BCLog::SELECTCOINS, "SelectCoins() best subset: "); /* Continued */
             for (unsigned int i = 0; i < applicable_groups.size(); i++) {
                 if (vfBest[i]) {
-                    LogPrint(BCLog::SELECTCOINS, "%s ", FormatMoney(applicable_groups[i].m_value)); /* Continued */
+                    LogPrint(BCLog::SELECTCOINS, "%s ", FormatMoney(applicable_groups[i]->m_value)); /* Continued */
                 }
             }
             LogPrint(BCLog::SELECTCOINS, "total %s\n", FormatMoney(nBest));
@@ -153,6 +153,10 @@ bool BerkeleyEnvironment::Open(bool retry)
     dbenv->set_lg_max(1048576);
     dbenv->set_lk_max_locks(40000);
     dbenv->set_lk_max_objects(40000);
+    // A WalletBatchScope holds its page locks across many writes. Should a
+    // writer on another thread deadlock with it, fail that writer (the one
+    // with the fewest writes) rather than hang or lose the scope's writes.
+    dbenv->set_lk_detect(DB_LOCK_MINWRITE);
     dbenv->set_errfile(fsbridge::fopen(pathErrorFile, "a")); /// debug
     dbenv->set_flags(DB_AUTO_COMMIT, 1);
     dbenv->set_flags(DB_TXN_WRITE_NOSYNC, 1);
@@ -212,6 +216,7 @@ void BerkeleyEnvironment::MakeMock()
     dbenv->set_lg_max(10485760);
     dbenv->set_lk_max_locks(10000);
     dbenv->set_lk_max_objects(10000);
+    dbenv->set_lk_detect(DB_LOCK_MINWRITE);
     dbenv->set_flags(DB_AUTO_COMMIT, 1);
     dbenv->log_set_config(DB_LOG_IN_MEMORY, 1);
     int ret = dbenv->open(nullptr,
@@ -443,7 +448,7 @@ void BerkeleyEnvironment::CheckpointLSN(const std::string& strFile)
 }
 
 
-BerkeleyBatch::BerkeleyBatch(BerkeleyDatabase& database, const char* pszMode, bool fFlushOnCloseIn) : pdb(nullptr), activeTxn(nullptr)
+BerkeleyBatch::BerkeleyBatch(BerkeleyDatabase& database, const char* pszMode, bool fFlushOnCloseIn) : pdb(nullptr), activeTxn(nullptr), m_database(database), m_joined_shared_txn(false)
 {
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
     fFlushOnClose = fFlushOnCloseIn;
@@ -519,6 +524,11 @@ BerkeleyBatch::BerkeleyBatch(BerkeleyDatabase& database, const char* pszMode, bo
         }
         ++env->mapFileUseCount[strFilename];
         strFile = strFilename;
+
+        if (database.m_shared_txn && database.m_shared_txn_owner == std::this_thread::get_id()) {
+            activeTxn = database.m_shared_txn;
+            m_joined_shared_txn = true;
+        }
     }
 }
 
@@ -544,12 +554,17 @@ void BerkeleyBatch::Close()
 {
     if (!pdb)
         return;
-    if (activeTxn)
+    if (activeTxn && !m_joined_shared_txn) {
+        LOCK(cs_db);
+        if (m_database.m_shared_txn == activeTxn)
+            m_database.m_shared_txn = nullptr;
         activeTxn->abort();
+    }
     activeTxn = nullptr;
     pdb = nullptr;
 
-    if (fFlushOnClose)
+    // The shared transaction is flushed once, when the batch owning it closes.
+    if (fFlushOnClose && !m_joined_shared_txn)
         Flush();
 
     {
@@ -558,6 +573,40 @@ void BerkeleyBatch::Close()
     }
 }
 
+bool BerkeleyBatch::TxnBeginShared()
+{
+    if (!TxnBegin())
+        return false;
+    LOCK(cs_db);
+    if (m_database.m_shared_txn) {
+        // Another thread is in the middle of a bulk operation
+        TxnAbort();
+        return false;
+    }
+    m_database.m_shared_txn = activeTxn;
+    m_database.m_shared_txn_owner = std::this_thread::get_id();
+    m_database.m_shared_txn_writes = 0;
+    return true;
+}
+
+bool BerkeleyBatch::TxnCommitShared()
+{
+    {
+        LOCK(cs_db);
+        if (!activeTxn || m_database.m_shared_txn != activeTxn)
+            return false;
+        m_database.m_shared_txn = nullptr;
+    }
+    return TxnCommit();
+}
+
+bool BerkeleyBatch::TxnRenewShared(unsigned int max_writes)
+{
+    if (m_database.m_shared_txn_writes < max_writes)
+        return true;
+    return TxnCommitShared() && TxnBeginShared();
+}
+
 void BerkeleyEnvironment::CloseDb(const std::string& strFile)
 {
     {
@@ -18,6 +18,7 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <db_cxx.h>
@@ -154,6 +155,15 @@ private:
     /** BerkeleyDB specific */
     BerkeleyEnvironment *env;
     std::string strFile;
+    /** Transaction joined by every batch opened on this database while it is
+     * active, see BerkeleyBatch::TxnBeginShared(). Guarded by cs_db. */
+    DbTxn* m_shared_txn = nullptr;
+    /** Thread that began m_shared_txn. Batches opened on other threads, such
+     * as the scheduler's, use transactions of their own. Guarded by cs_db. */
+    std::thread::id m_shared_txn_owner;
+    /** Records written by the batches that joined m_shared_txn so far. Only
+     * used by its owning thread. */
+    unsigned int m_shared_txn_writes = 0;
 
     /** Return whether this database handle is a dummy for testing.
      * Only to be used at a low level, application should ideally not care
@@ -173,6 +183,9 @@ protected:
     bool fReadOnly;
     bool fFlushOnClose;
     BerkeleyEnvironment *env;
+    BerkeleyDatabase& m_database;
+    //! Whether activeTxn is the database's shared transaction, owned by another batch.
+    bool m_joined_shared_txn;
 
 public:
     explicit BerkeleyBatch(BerkeleyDatabase& database, const char* pszMode = "r+", bool fFlushOnCloseIn=true);
@@ -251,6 +264,8 @@ public:
 
         // Write
         int ret = pdb->put(activeTxn, &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
+        if (m_joined_shared_txn)
+            ++m_database.m_shared_txn_writes;
 
         // Clear memory in case it was a private key
         memory_cleanse(datKey.get_data(), datKey.get_size());
@@ -274,6 +289,8 @@ public:
 
         // Erase
         int ret = pdb->del(activeTxn, &datKey, 0);
+        if (m_joined_shared_txn)
+            ++m_database.m_shared_txn_writes;
 
         // Clear memory
         memory_cleanse(datKey.get_data(), datKey.get_size());
@@ -360,7 +377,7 @@ public:
 
     bool TxnCommit()
     {
-        if (!pdb || !activeTxn)
+        if (!pdb || !activeTxn || m_joined_shared_txn)
             return false;
         int ret = activeTxn->commit(0);
         activeTxn = nullptr;
@@ -369,13 +386,25 @@ public:
 
     bool TxnAbort()
     {
-        if (!pdb || !activeTxn)
+        if (!pdb || !activeTxn || m_joined_shared_txn)
             return false;
         int ret = activeTxn->abort();
         activeTxn = nullptr;
         return (ret == 0);
     }
 
+    /** Begin a transaction that every other batch opened on the same database
+     * from the same thread joins until TxnCommitShared(), instead of committing
+     * each of their writes separately and flushing when they close. Those
+     * batches must be closed before the transaction is committed. */
+    bool TxnBeginShared();
+    /** Commit the transaction begun by TxnBeginShared(). */
+    bool TxnCommitShared();
+    /** Commit the transaction begun by TxnBeginShared() and begin a new one if
+     * the batches that joined it wrote at least max_writes records. Keeps the
+     * locks a long bulk operation holds within the environment's limits. */
+    bool TxnRenewShared(unsigned int max_writes);
+
     bool ReadVersion(int& nVersion)
     {
         nVersion = 0;
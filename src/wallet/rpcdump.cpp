@@ -556,8 +556,12 @@ UniValue importwallet(const JSONRPCRequest& request)
         // Use uiInterface.ShowProgress instead of pwallet.ShowProgress because pwallet.ShowProgress has a cancel button tied to AbortRescan which
         // we don't want for this progress bar showing the import progress. uiInterface.ShowProgress does not have a cancel button.
         uiInterface.ShowProgress(strprintf("%s " + _("Importing..."), pwallet->GetDisplayName()), 0, false); // show progress dialog in GUI
+        WalletBatchScope batch_scope(pwallet->GetDBHandle());
         while (file.good()) {
             uiInterface.ShowProgress("", std::max(1, std::min(99, (int)(((double)file.tellg() / (double)nFilesize) * 100))), false);
+            if (!batch_scope.Checkpoint()) {
+                fGood = false;
+            }
             std::string line;
             std::getline(file, line);
             if (line.empty() || line[0] == '#')
@@ -621,6 +625,9 @@ UniValue importwallet(const JSONRPCRequest& request)
             }
         }
         file.close();
+        if (!batch_scope.Commit()) {
+            fGood = false;
+        }
         uiInterface.ShowProgress("", 100, false); // hide progress dialog in GUI
         pwallet->UpdateTimeFirstKey(nTimeBegin);
     }
@@ -1243,7 +1250,12 @@ UniValue importmulti(const JSONRPCRequest& mainRequest)
             fRescan = false;
         }
 
+        // Write all imported keys and scripts to the database at once.
+        WalletBatchScope batch_scope(pwallet->GetDBHandle());
         for (const UniValue& data : requests.getValues()) {
+            if (!batch_scope.Checkpoint()) {
+                throw JSONRPCError(RPC_WALLET_ERROR, "Error writing imported keys and scripts to wallet");
+            }
             const int64_t timestamp = std::max(GetImportTimestamp(data, now), minimumTimestamp);
             const UniValue result = ProcessImport(pwallet, data, timestamp);
             response.push_back(result);
@@ -1262,6 +1274,9 @@ UniValue importmulti(const JSONRPCRequest& mainRequest)
                 nLowestTimestamp = timestamp;
             }
         }
+        if (!batch_scope.Commit()) {
+            throw JSONRPCError(RPC_WALLET_ERROR, "Error writing imported keys and scripts to wallet");
+        }
     }
     if (fRescan && fRunScan && requests.size()) {
         int64_t scannedTime = pwallet->RescanFromTime(nLowestTimestamp, reserver, true /* update */);
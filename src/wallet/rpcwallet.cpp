@@ -158,6 +158,7 @@ static void WalletTxToJSON(const CWalletTx& wtx, UniValue& entry)
     entry.pushKV("walletconflicts", conflicts);
     entry.pushKV("time", wtx.GetTxTime());
     entry.pushKV("timereceived", (int64_t)wtx.nTimeReceived);
+    entry.pushKV("orderpos", wtx.nOrderPos);
 
     // Add opt-in RBF status
     std::string rbfStatus = "no";
@@ -2085,8 +2086,10 @@ static void MaybePushAddress(UniValue & entry, const CTxDestination &dest)
  * @param  fLong      Whether to include the JSON version of the transaction.
  * @param  ret        The UniValue into which the result is stored.
  * @param  filter     The "is mine" filter bool.
+ * @param  skip       If set, the number of matching entries to leave out of ret, counting down.
+ *                    Entries that are left out are not built.
  */
-static void ListTransactions(CWallet* const pwallet, const CWalletTx& wtx, const std::string& strAccount, int nMinDepth, bool fLong, UniValue& ret, const isminefilter& filter)
+static void ListTransactions(CWallet* const pwallet, const CWalletTx& wtx, const std::string& strAccount, int nMinDepth, bool fLong, UniValue& ret, const isminefilter& filter, int* skip = nullptr)
 {
     CAmount nFee;
     std::string strSentAccount;
@@ -2108,6 +2111,10 @@ static void ListTransactions(CWallet* const pwallet, const CWalletTx& wtx, const
     if (list_sent) {
         for (const COutputEntry& s : listSent)
         {
+            if (skip && *skip > 0) {
+                --*skip;
+                continue;
+            }
             UniValue entry(UniValue::VOBJ);
             if (involvesWatchonly || (::IsMine(*pwallet, s.destination) & ISMINE_WATCH_ONLY)) {
                 entry.pushKV("involvesWatchonly", true);
@@ -2139,6 +2146,10 @@ static void ListTransactions(CWallet* const pwallet, const CWalletTx& wtx, const
             }
             if (fAllAccounts || (account == strAccount))
             {
+                if (skip && *skip > 0) {
+                    --*skip;
+                    continue;
+                }
                 UniValue entry(UniValue::VOBJ);
                 if (involvesWatchonly || (::IsMine(*pwallet, r.destination) & ISMINE_WATCH_ONLY)) {
                     entry.pushKV("involvesWatchonly", true);
@@ -2171,16 +2182,21 @@ static void ListTransactions(CWallet* const pwallet, const CWalletTx& wtx, const
     }
 }
 
-static void AcentryToJSON(const CAccountingEntry& acentry, const std::string& strAccount, UniValue& ret)
+static void AcentryToJSON(const CAccountingEntry& acentry, const std::string& strAccount, UniValue& ret, int* skip = nullptr)
 {
     bool fAllAccounts = (strAccount == std::string("*"));
 
     if (fAllAccounts || acentry.strAccount == strAccount)
     {
+        if (skip && *skip > 0) {
+            --*skip;
+            return;
+        }
         UniValue entry(UniValue::VOBJ);
         entry.pushKV("account", acentry.strAccount);
         entry.pushKV("category", "move");
         entry.pushKV("time", acentry.nTime);
+        entry.pushKV("orderpos", acentry.nOrderPos);
         entry.pushKV("amount", ValueFromAmount(acentry.nCreditDebit));
         if (IsDeprecatedRPCEnabled("accounts")) entry.pushKV("otheraccount", acentry.strOtherAccount);
         entry.pushKV("comment", acentry.strComment);
@@ -2199,7 +2215,7 @@ UniValue listtransactions(const JSONRPCRequest& request)
 
     std::string help_text {};
     if (!IsDeprecatedRPCEnabled("accounts")) {
-        help_text = "listtransactions (label count skip include_watchonly)\n"
+        help_text = "listtransactions (label count skip include_watchonly cursor)\n"
             "\nIf a label name is provided, this will return only incoming transactions paying to addresses with the specified label.\n"
             "\nReturns up to 'count' most recent transactions skipping the first 'from' transactions.\n"
             "Note that the \"account\" argument and \"otheraccount\" return value have been removed in V0.17. To use this RPC with an \"account\" argument, restart\n"
@@ -2210,6 +2226,9 @@ UniValue listtransactions(const JSONRPCRequest& request)
             "2. count          (numeric, optional, default=10) The number of transactions to return\n"
             "3. skip           (numeric, optional, default=0) The number of transactions to skip\n"
             "4. include_watchonly (bool, optional, default=false) Include transactions to watch-only addresses (see 'importaddress')\n"
+            "5. cursor         (numeric, optional) Only list transactions before this \"orderpos\", such as the first \"orderpos\" of\n"
+            "                  the previous call, to page through the list without skipping over it (-1 to start from the most\n"
+            "                  recent one). The oldest transaction is then returned whole, which can make for more than 'count' entries.\n"
             "\nResult:\n"
             "[\n"
             "  {\n"
@@ -2230,6 +2249,7 @@ UniValue listtransactions(const JSONRPCRequest& request)
             "    \"txid\": \"transactionid\", (string) The transaction id.\n"
             "    \"time\": xxx,              (numeric) The transaction time in seconds since epoch (midnight Jan 1 1970 GMT).\n"
             "    \"timereceived\": xxx,      (numeric) The time received in seconds since epoch (midnight Jan 1 1970 GMT).\n"
+            "    \"orderpos\": n,            (numeric) The position of the transaction in the wallet's transaction order.\n"
             "    \"comment\": \"...\",       (string) If a comment is associated with the transaction.\n"
             "    \"bip125-replaceable\": \"yes|no|unknown\",  (string) Whether this transaction could be replaced due to BIP125 (replace-by-fee);\n"
             "                                                     may be unknown for unconfirmed transactions not in the mempool\n"
@@ -2243,16 +2263,21 @@ UniValue listtransactions(const JSONRPCRequest& request)
             + HelpExampleCli("listtransactions", "") +
             "\nList transactions 100 to 120\n"
             + HelpExampleCli("listtransactions", "\"*\" 20 100") +
+            "\nList the 20 transactions before order position 1000\n"
+            + HelpExampleCli("listtransactions", "\"*\" 20 0 false 1000") +
             "\nAs a json rpc call\n"
             + HelpExampleRpc("listtransactions", "\"*\", 20, 100");
     } else {
-        help_text = "listtransactions ( \"account\" count skip include_watchonly)\n"
+        help_text = "listtransactions ( \"account\" count skip include_watchonly cursor)\n"
             "\nReturns up to 'count' most recent transactions skipping the first 'from' transactions for account 'account'.\n"
             "\nArguments:\n"
             "1. \"account\"    (string, optional) DEPRECATED. This argument will be removed in V0.18. The account name. Should be \"*\".\n"
             "2. count          (numeric, optional, default=10) The number of transactions to return\n"
             "3. skip           (numeric, optional, default=0) The number of transactions to skip\n"
             "4. include_watchonly (bool, optional, default=false) Include transactions to watch-only addresses (see 'importaddress')\n"
+            "5. cursor         (numeric, optional) Only list transactions before this \"orderpos\", such as the first \"orderpos\" of\n"
+            "                  the previous call, to page through the list without skipping over it (-1 to start from the most\n"
+            "                  recent one). The oldest transaction is then returned whole, which can make for more than 'count' entries.\n"
             "\nResult:\n"
             "[\n"
             "  {\n"
@@ -2284,6 +2309,7 @@ UniValue listtransactions(const JSONRPCRequest& request)
             "    \"time\": xxx,              (numeric) The transaction time in seconds since epoch (midnight Jan 1 1970 GMT).\n"
             "    \"timereceived\": xxx,      (numeric) The time received in seconds since epoch (midnight Jan 1 1970 GMT). Available \n"
             "                                          for 'send' and 'receive' category of transactions.\n"
+            "    \"orderpos\": n,            (numeric) The position of the transaction in the wallet's transaction order.\n"
             "    \"comment\": \"...\",       (string) If a comment is associated with the transaction.\n"
             "    \"otheraccount\": \"accountname\",  (string) DEPRECATED. This field will be removed in V0.18. For the 'move' category of transactions, the account the funds came \n"
             "                                          from (for receiving funds, positive amounts), or went to (for sending funds,\n"
@@ -2300,10 +2326,12 @@ UniValue listtransactions(const JSONRPCRequest& request)
             + HelpExampleCli("listtransactions", "") +
             "\nList transactions 100 to 120\n"
             + HelpExampleCli("listtransactions", "\"*\" 20 100") +
+            "\nList the 20 transactions before order position 1000\n"
+            + HelpExampleCli("listtransactions", "\"*\" 20 0 false 1000") +
             "\nAs a json rpc call\n"
             + HelpExampleRpc("listtransactions", "\"*\", 20, 100");
     }
-    if (request.fHelp || request.params.size() > 4) throw std::runtime_error(help_text);
+    if (request.fHelp || request.params.size() > 5) throw std::runtime_error(help_text);
 
     // Make sure the results are valid at least up to the most recent block
     // the user could have gotten from another RPC command prior to now
@@ -2327,6 +2355,9 @@ UniValue listtransactions(const JSONRPCRequest& request)
         if(request.params[3].get_bool())
             filter = filter | ISMINE_WATCH_ONLY;
 
+    bool fCursor = !request.params[4].isNull();
+    int64_t nCursor = fCursor ? request.params[4].get_int64() : 0;
+
     if (nCount < 0)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
     if (nFrom < 0)
@@ -2339,37 +2370,31 @@ UniValue listtransactions(const JSONRPCRequest& request)
 
         const CWallet::TxItems & txOrdered = pwallet->wtxOrdered;
 
-        // iterate backwards until we have nCount items to return:
-        for (CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+        // iterate backwards until we have nCount items to return, counting but not
+        // building the first nFrom, starting right before the cursor if given:
+        int skip = nFrom;
+        CWallet::TxItems::const_reverse_iterator start = fCursor && nCursor >= 0 ? CWallet::TxItems::const_reverse_iterator(txOrdered.lower_bound(nCursor)) : txOrdered.rbegin();
+        for (CWallet::TxItems::const_reverse_iterator it = start; it != txOrdered.rend(); ++it)
         {
             CWalletTx *const pwtx = (*it).second.first;
             if (pwtx != nullptr)
-                ListTransactions(pwallet, *pwtx, strAccount, 0, true, ret, filter);
+                ListTransactions(pwallet, *pwtx, strAccount, 0, true, ret, filter, &skip);
             if (IsDeprecatedRPCEnabled("accounts")) {
                 CAccountingEntry *const pacentry = (*it).second.second;
-                if (pacentry != nullptr) AcentryToJSON(*pacentry, strAccount, ret);
+                if (pacentry != nullptr) AcentryToJSON(*pacentry, strAccount, ret, &skip);
             }
 
-            if ((int)ret.size() >= (nCount+nFrom)) break;
+            if ((int)ret.size() >= nCount) break;
         }
     }
 
     // ret is newest to oldest
 
-    if (nFrom > (int)ret.size())
-        nFrom = ret.size();
-    if ((nFrom + nCount) > (int)ret.size())
-        nCount = ret.size() - nFrom;
-
     std::vector<UniValue> arrTmp = ret.getValues();
 
-    std::vector<UniValue>::iterator first = arrTmp.begin();
-    std::advance(first, nFrom);
-    std::vector<UniValue>::iterator last = arrTmp.begin();
-    std::advance(last, nFrom+nCount);
-
-    if (last != arrTmp.end()) arrTmp.erase(last, arrTmp.end());
-    if (first != arrTmp.begin()) arrTmp.erase(arrTmp.begin(), first);
+    // A cursor for the next call must not fall inside a transaction, so keep the
+    // oldest one whole.
+    if (!fCursor && (int)arrTmp.size() > nCount) arrTmp.erase(arrTmp.begin() + nCount, arrTmp.end());
 
     std::reverse(arrTmp.begin(), arrTmp.end()); // Return oldest to newest
 
@@ -2578,11 +2603,11 @@ static UniValue listsinceblock(const JSONRPCRequest& request)
 
     UniValue transactions(UniValue::VARR);
 
-    for (const std::pair<const uint256, CWalletTx>& pairWtx : pwallet->mapWallet) {
-        CWalletTx tx = pairWtx.second;
-
-        if (depth == -1 || tx.GetDepthInMainChain() < depth) {
-            ListTransactions(pwallet, tx, "*", 0, true, transactions, filter);
+    // Only transactions confirmed above the given block, or not confirmed in the
+    // active chain at all, can have fewer confirmations than it.
+    for (const CWalletTx* pwtx : pwallet->GetTxsAboveHeight(pindex ? pindex->nHeight : -1)) {
+        if (depth == -1 || pwtx->GetDepthInMainChain() < depth) {
+            ListTransactions(pwallet, *pwtx, "*", 0, true, transactions, filter);
         }
     }
 
@@ -5136,7 +5161,7 @@ static const CRPCCommand commands[] =
     { "wallet",             "listlockunspent",                  &listlockunspent,               {} },
     { "wallet",             "listreceivedbyaddress",            &listreceivedbyaddress,         {"minconf","include_empty","include_watchonly","address_filter"} },
     { "wallet",             "listsinceblock",                   &listsinceblock,                {"blockhash","target_confirmations","include_watchonly","include_removed"} },
-    { "wallet",             "listtransactions",                 &listtransactions,              {"account|label|dummy","count","skip","include_watchonly"} },
+    { "wallet",             "listtransactions",                 &listtransactions,              {"account|label|dummy","count","skip","include_watchonly","cursor"} },
     { "wallet",             "listunspent",                      &listunspent,                   {"minconf","maxconf","addresses","include_unsafe","query_options"} },
     { "wallet",             "listwallets",                      &listwallets,                   {} },
     { "wallet",             "loadwallet",                       &loadwallet,                    {"filename"} },
@@ -544,6 +544,27 @@ BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
     empty_wallet();
 }
 
+// On a pool this large ApproximateBestSubset runs far fewer than its 1000 iterations
+// (APPROXIMATE_BEST_SUBSET_MAX_VISITS). Check that the selection stays close to the
+// target plus MIN_CHANGE anyway: the uncapped search does not get much closer either.
+BOOST_AUTO_TEST_CASE(knapsack_large_pool_test)
+{
+    FastRandomContext rand(true);
+    std::vector<CInputCoin> utxo_pool;
+    for (int i = 0; i < 100000; ++i) {
+        add_coin(1000 + rand.randrange(100 * COIN) / (1 + rand.randrange(1000)), i, utxo_pool);
+    }
+
+    for (int i = 0; i < 10; ++i) {
+        const CAmount target = 1 * COIN + rand.randrange(20 * COIN);
+        CoinSet selection;
+        CAmount value_ret = 0;
+        BOOST_CHECK(KnapsackSolver(target, GroupCoins(utxo_pool), selection, value_ret));
+        BOOST_CHECK_GE(value_ret, target);
+        BOOST_CHECK_LE(value_ret, target + MIN_CHANGE + CENT / 100);
+    }
+}
+
 // Tests that with the ideal conditions, the coin selector will always be able to find a solution that can pay the target value
 BOOST_AUTO_TEST_CASE(SelectCoins_test)
 {
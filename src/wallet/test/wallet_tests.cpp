@@ -4,13 +4,16 @@
 
 #include <wallet/wallet.h>
 
+#include <atomic>
 #include <memory>
 #include <set>
 #include <stdint.h>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include <consensus/validation.h>
+#include <index/blockfilterindex.h>
 #include <rpc/server.h>
 #include <test/test_bitcoin.h>
 #include <validation.h>
@@ -366,6 +369,266 @@ BOOST_FIXTURE_TEST_CASE(ListCoins, ListCoinsTestingSetup)
     BOOST_CHECK_EQUAL(list.begin()->second.size(), 2U);
 }
 
+// Check that balances, which are summed over the transactions that still hold
+// credit, follow spends and coinbase maturity.
+BOOST_FIXTURE_TEST_CASE(balances_follow_spends, ListCoinsTestingSetup)
+{
+    // One mature coinbase, and 100 immature ones.
+    BOOST_CHECK_EQUAL(wallet->GetBalance(), 50 * COIN);
+    BOOST_CHECK_EQUAL(wallet->GetImmatureBalance(), 100 * 50 * COIN);
+
+    // Spending the mature coinbase leaves its change. The block confirming the
+    // spend also matures the next coinbase, without the wallet being notified.
+    AddTx(CRecipient{GetScriptForRawPubKey({}), 10 * COIN, false /* subtract fee */});
+    const CAmount balance = wallet->GetBalance();
+    BOOST_CHECK(balance < 90 * COIN && balance > 90 * COIN - COIN / 100);
+    BOOST_CHECK_EQUAL(balance, wallet->GetAvailableBalance());
+    BOOST_CHECK_EQUAL(wallet->GetImmatureBalance(), 99 * 50 * COIN);
+    BOOST_CHECK_EQUAL(wallet->GetUnconfirmedBalance(), 0);
+
+    // The spent coinbase is no longer listed; its change and the newly mature
+    // coinbase are.
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        std::vector<COutput> available;
+        wallet->AvailableCoins(available);
+        BOOST_CHECK_EQUAL(available.size(), 2U);
+        for (const COutput& out : available) {
+            BOOST_CHECK(!wallet->IsSpent(out.tx->GetHash(), out.i));
+        }
+    }
+
+    // Dropping all cached state gives the same balances.
+    wallet->MarkDirty();
+    BOOST_CHECK_EQUAL(wallet->GetBalance(), balance);
+    BOOST_CHECK_EQUAL(wallet->GetImmatureBalance(), 99 * 50 * COIN);
+}
+
+BOOST_FIXTURE_TEST_CASE(txs_above_height, ListCoinsTestingSetup)
+{
+    // One coinbase per block, each confirmed at its own height.
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        BOOST_CHECK_EQUAL(wallet->GetTxsAboveHeight(-1).size(), 101U);
+        BOOST_CHECK_EQUAL(wallet->GetTxsAboveHeight(0).size(), 101U);
+        BOOST_CHECK_EQUAL(wallet->GetTxsAboveHeight(chainActive.Height() - 10).size(), 10U);
+        BOOST_CHECK(wallet->GetTxsAboveHeight(chainActive.Height()).empty());
+    }
+
+    // A new transaction is filed under the height of the block confirming it.
+    const CWalletTx& wtx = AddTx(CRecipient{GetScriptForRawPubKey({}), 10 * COIN, false /* subtract fee */});
+    LOCK2(cs_main, wallet->cs_wallet);
+    const std::vector<const CWalletTx*> txs = wallet->GetTxsAboveHeight(chainActive.Height() - 1);
+    BOOST_CHECK_EQUAL(txs.size(), 1U);
+    BOOST_CHECK(txs.size() == 1 && txs[0] == &wtx);
+}
+
+static CMutableTransaction SpendCoinbase(const CTransactionRef& coinbase, const CKey& key, const CScript& script_pub_key, CAmount value)
+{
+    CMutableTransaction tx;
+    tx.nVersion = 1;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(coinbase->GetHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = script_pub_key;
+    tx.vout[0].nValue = value;
+    std::vector<unsigned char> sig;
+    const uint256 hash = SignatureHash(coinbase->vout[0].scriptPubKey, tx, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_CHECK(key.Sign(hash, sig));
+    sig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << sig;
+    return tx;
+}
+
+BOOST_FIXTURE_TEST_CASE(filtered_rescan, TestChain100Setup)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript wallet_script = GetScriptForDestination(key.GetPubKey().GetID());
+    const CScript foreign_script = GetScriptForRawPubKey(coinbaseKey.GetPubKey());
+
+    // A block paying the wallet, then a block double-spending a payment to
+    // the wallet that is still unconfirmed, then blocks with nothing for it.
+    CreateAndProcessBlock({SpendCoinbase(m_coinbase_txns[0], coinbaseKey, wallet_script, 49 * COIN)}, foreign_script);
+    const CTransactionRef unconfirmed = MakeTransactionRef(SpendCoinbase(m_coinbase_txns[1], coinbaseKey, wallet_script, 48 * COIN));
+    CreateAndProcessBlock({SpendCoinbase(m_coinbase_txns[1], coinbaseKey, foreign_script, 47 * COIN)}, foreign_script);
+    for (int i = 0; i < 5; i++) {
+        CreateAndProcessBlock({}, foreign_script);
+    }
+
+    std::unique_ptr<BlockFilterIndex> filter_index = MakeUnique<BlockFilterIndex>(BlockFilterType::BASIC, 1 << 20, true);
+    filter_index->Start();
+    const int64_t time_start = GetTimeMillis();
+    while (!filter_index->BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + 10 * 1000 > GetTimeMillis());
+        MilliSleep(100);
+    }
+
+    // Rescan a wallet with and without the unconfirmed payment, with and
+    // without block filters, and compare.
+    for (bool with_unconfirmed : {false, true}) {
+        std::vector<std::pair<CAmount, int>> results;
+        for (bool filtered : {false, true}) {
+            if (filtered) g_blockfilterindex = std::move(filter_index);
+
+            CWallet wallet("dummy", WalletDatabase::CreateDummy());
+            AddKey(wallet, key);
+            if (with_unconfirmed) {
+                LOCK(wallet.cs_wallet);
+                wallet.AddToWallet(CWalletTx(&wallet, unconfirmed));
+            }
+            CBlockIndex* genesis;
+            {
+                LOCK(cs_main);
+                genesis = chainActive.Genesis();
+            }
+            WalletRescanReserver reserver(&wallet);
+            reserver.reserve();
+            BOOST_CHECK(wallet.ScanForWalletTransactions(genesis, nullptr, reserver) == nullptr);
+
+            LOCK2(cs_main, wallet.cs_wallet);
+            const int depth = with_unconfirmed ? wallet.mapWallet.at(unconfirmed->GetHash()).GetDepthInMainChain() : 0;
+            results.emplace_back(wallet.GetBalance(), depth);
+            BOOST_CHECK_EQUAL(wallet.mapWallet.size(), with_unconfirmed ? 2U : 1U);
+            if (filtered) filter_index = std::move(g_blockfilterindex);
+        }
+        BOOST_CHECK_EQUAL(results[0].first, 49 * COIN);
+        BOOST_CHECK_EQUAL(results[1].first, results[0].first);
+        BOOST_CHECK_EQUAL(results[1].second, results[0].second);
+        // The double-spend was found, although its block has none of the wallet's scripts
+        if (with_unconfirmed) BOOST_CHECK(results[1].second < 0);
+    }
+
+    filter_index->Stop();
+}
+
+BOOST_AUTO_TEST_CASE(batch_scope_groups_writes)
+{
+    WalletDatabase& database = m_wallet.GetDBHandle();
+    CKeyPool keypool;
+    {
+        WalletBatchScope scope(database);
+        {
+            // A nested scope joins the outer one, so committing it does nothing.
+            WalletBatchScope nested(database);
+            BOOST_CHECK(WalletBatch(database).WritePool(1, CKeyPool()));
+            BOOST_CHECK(nested.Commit());
+        }
+        BOOST_CHECK(WalletBatch(database).WritePool(2, CKeyPool()));
+
+        // Batches opened in the scope see the writes made in it so far.
+        BOOST_CHECK(WalletBatch(database).ReadPool(1, keypool));
+        BOOST_CHECK(scope.Commit());
+        BOOST_CHECK(scope.Commit());
+    }
+    BOOST_CHECK(WalletBatch(database).ReadPool(1, keypool));
+    BOOST_CHECK(WalletBatch(database).ReadPool(2, keypool));
+
+    // Outside of a scope, batches commit their own writes again.
+    BOOST_CHECK(WalletBatch(database).WritePool(3, CKeyPool()));
+    BOOST_CHECK(WalletBatch(database).ReadPool(3, keypool));
+}
+
+BOOST_AUTO_TEST_CASE(batch_scope_checkpoint)
+{
+    WalletDatabase& database = m_wallet.GetDBHandle();
+    CKeyPool keypool;
+    WalletBatchScope scope(database);
+    const int64_t num_writes = WalletBatchScope::MAX_WRITES;
+    for (int64_t i = 1; i <= num_writes; ++i) {
+        BOOST_CHECK(WalletBatch(database).WritePool(i, CKeyPool()));
+        BOOST_CHECK(scope.Checkpoint());
+    }
+    // The scope went on in a new transaction after committing the first one.
+    BOOST_CHECK(WalletBatch(database).WritePool(num_writes + 1, CKeyPool()));
+    BOOST_CHECK(scope.Commit());
+    BOOST_CHECK(WalletBatch(database).ReadPool(1, keypool));
+    BOOST_CHECK(WalletBatch(database).ReadPool(num_writes + 1, keypool));
+}
+
+BOOST_AUTO_TEST_CASE(batch_scope_other_thread)
+{
+    WalletDatabase& database = m_wallet.GetDBHandle();
+    WalletBatchScope scope(database);
+    BOOST_CHECK(WalletBatch(database).WritePool(1, CKeyPool()));
+
+    // A scope begun on another thread meanwhile neither joins nor replaces
+    // this one; its batches would use transactions of their own.
+    std::thread other([&database] {
+        WalletBatchScope other_scope(database);
+        BOOST_CHECK(other_scope.Commit());
+    });
+    other.join();
+    BOOST_CHECK(scope.Commit());
+
+    CKeyPool keypool;
+    BOOST_CHECK(WalletBatch(database).ReadPool(1, keypool));
+}
+
+BOOST_AUTO_TEST_CASE(batch_scope_concurrent_writer)
+{
+    // Writers on other threads wait for the page locks a scope holds. When
+    // that leads to a deadlock, the lock detector aborts the writer with the
+    // fewest writes rather than the scope's transaction.
+    WalletDatabase& database = m_wallet.GetDBHandle();
+    std::atomic<bool> stop(false);
+    std::atomic<int> other_written(0);
+    std::thread other([&] {
+        while (!stop) {
+            if (WalletBatch(database).WriteBestBlock(CBlockLocator())) ++other_written;
+        }
+    });
+    {
+        WalletBatchScope scope(database);
+        for (unsigned int i = 0; i < 3 * WalletBatchScope::MAX_WRITES; i++) {
+            BOOST_REQUIRE(WalletBatch(database).WritePool(i, CKeyPool()));
+            BOOST_REQUIRE(scope.Checkpoint());
+        }
+        BOOST_CHECK(scope.Commit());
+    }
+    stop = true;
+    other.join();
+    BOOST_CHECK(other_written > 0);
+
+    CKeyPool keypool;
+    BOOST_CHECK(WalletBatch(database).ReadPool(3 * WalletBatchScope::MAX_WRITES - 1, keypool));
+}
+
+BOOST_AUTO_TEST_CASE(topup_keypool_derives_hd_chains)
+{
+    const uint32_t HARDENED = 0x80000000;
+    LOCK(m_wallet.cs_wallet);
+    m_wallet.SetMinVersion(FEATURE_LATEST);
+    m_wallet.SetHDSeed(m_wallet.GenerateNewSeed());
+
+    // Pretend a key further down the external chain was imported: it is skipped.
+    CKey seed;
+    BOOST_REQUIRE(m_wallet.GetKey(m_wallet.GetHDChain().seed_id, seed));
+    CExtKey master, account, chains[2], child;
+    master.SetSeed(seed.begin(), seed.size());
+    master.Derive(account, HARDENED);
+    account.Derive(chains[0], HARDENED);
+    account.Derive(chains[1], HARDENED + 1);
+    chains[0].Derive(child, 150 | HARDENED);
+    BOOST_CHECK(m_wallet.AddKeyPubKey(child.key, child.key.GetPubKey()));
+
+    BOOST_CHECK(m_wallet.TopUpKeyPool(200));
+    BOOST_CHECK_EQUAL(m_wallet.KeypoolCountExternalKeys(), 200U);
+    BOOST_CHECK_EQUAL(m_wallet.GetHDChain().nExternalChainCounter, 201U);
+    BOOST_CHECK_EQUAL(m_wallet.GetHDChain().nInternalChainCounter, 200U);
+
+    // Keys derived in parallel are the ones a serial derivation gives, with their keypaths.
+    for (int chain = 0; chain < 2; ++chain) {
+        for (unsigned int i = 0; i < 200; ++i) {
+            chains[chain].Derive(child, i | HARDENED);
+            const CKeyID id = child.key.GetPubKey().GetID();
+            BOOST_CHECK(m_wallet.HaveKey(id));
+            if (chain == 0 && i == 150) continue;
+            BOOST_CHECK_EQUAL(m_wallet.mapKeyMetadata[id].hdKeypath, strprintf("m/0'/%d'/%u'", chain, i));
+        }
+    }
+}
+
 BOOST_FIXTURE_TEST_CASE(wallet_disableprivkeys, TestChain100Setup)
 {
     std::shared_ptr<CWallet> wallet = std::make_shared<CWallet>("dummy", WalletDatabase::CreateDummy());
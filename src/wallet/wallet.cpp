@@ -11,6 +11,7 @@
 #include <consensus/consensus.h>
 #include <consensus/validation.h>
 #include <fs.h>
+#include <index/blockfilterindex.h>
 #include <key.h>
 #include <key_io.h>
 #include <keystore.h>
@@ -31,6 +32,7 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <deque>
 #include <future>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -181,12 +183,19 @@ const CWalletTx* CWallet::GetWalletTx(const uint256& hash) const
 }
 
 CPubKey CWallet::GenerateNewKey(WalletBatch &batch, bool internal)
+{
+    return GenerateNewKeys(batch, 1, internal).front();
+}
+
+std::vector<CPubKey> CWallet::GenerateNewKeys(WalletBatch &batch, size_t count, bool internal)
 {
     assert(!IsWalletFlagSet(WALLET_FLAG_DISABLE_PRIVATE_KEYS));
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     bool fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY); // default to compressed public keys if we want 0.6.0 wallets
 
-    CKey secret;
+    std::vector<CKey> secrets;
+    std::vector<CPubKey> pubkeys;
+    std::vector<CKeyMetadata> key_metadata;
 
     // Create new metadata
     int64_t nCreationTime = GetTime();
@@ -200,9 +209,17 @@ CPubKey CWallet::GenerateNewKey(WalletBatch &batch, bool internal)
 
     // use HD key derivation if HD was enabled during wallet creation
     if (IsHDEnabled()) {
-        DeriveNewChildKey(batch, metadata, secret, (CanSupportFeature(FEATURE_HD_SPLIT) ? internal : false));
+        DeriveNewChildKeys(batch, metadata, count, (CanSupportFeature(FEATURE_HD_SPLIT) ? internal : false), secrets, pubkeys, key_metadata);
     } else {
-        secret.MakeNewKey(fCompressed);
+        for (size_t i = 0; i < count; ++i) {
+            CKey secret;
+            secret.MakeNewKey(fCompressed);
+            CPubKey pubkey = secret.GetPubKey();
+            assert(secret.VerifyPubKey(pubkey));
+            secrets.push_back(secret);
+            pubkeys.push_back(pubkey);
+            key_metadata.push_back(metadata);
+        }
     }
 
     // Compressed public keys were introduced in version 0.6.0
@@ -210,26 +227,62 @@ CPubKey CWallet::GenerateNewKey(WalletBatch &batch, bool internal)
         SetMinVersion(FEATURE_COMPRPUBKEY);
     }
 
-    CPubKey pubkey = secret.GetPubKey();
-    assert(secret.VerifyPubKey(pubkey));
-
-    mapKeyMetadata[pubkey.GetID()] = metadata;
+    for (size_t i = 0; i < pubkeys.size(); ++i) {
+        mapKeyMetadata[pubkeys[i].GetID()] = key_metadata[i];
+        if (!AddKeyPubKeyWithDB(batch, secrets[i], pubkeys[i])) {
+            throw std::runtime_error(std::string(__func__) + ": AddKey failed");
+        }
+    }
     UpdateTimeFirstKey(nCreationTime);
 
-    if (!AddKeyPubKeyWithDB(batch, secret, pubkey)) {
-        throw std::runtime_error(std::string(__func__) + ": AddKey failed");
+    return pubkeys;
+}
+
+//! Smallest number of keys worth deriving on a thread of its own.
+static const size_t MIN_KEYS_PER_DERIVE_THREAD = 64;
+
+/**
+ * Derive the hardened children first_index, first_index + 1, ... of an
+ * extended key, and their public keys, splitting the work across the
+ * available cores. Only the private key of each child is derived: hardened
+ * derivation does not need the parent's public key, and the children's chain
+ * codes are not used.
+ */
+static void DeriveHardenedChildren(const CExtKey& parent, uint32_t first_index, size_t count, std::vector<CKey>& keys, std::vector<CPubKey>& pubkeys)
+{
+    keys.assign(count, CKey());
+    pubkeys.assign(count, CPubKey());
+
+    auto derive_range = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            ChainCode chaincode;
+            bool derived = parent.key.Derive(keys[i], chaincode, (first_index + i) | BIP32_HARDENED_KEY_LIMIT, parent.chaincode);
+            assert(derived);
+            pubkeys[i] = keys[i].GetPubKey();
+            assert(keys[i].VerifyPubKey(pubkeys[i]));
+        }
+    };
+
+    const size_t threads = std::max<size_t>(1, std::min<size_t>(GetNumCores(), count / MIN_KEYS_PER_DERIVE_THREAD));
+    const size_t chunk = (count + threads - 1) / threads;
+    std::vector<std::future<void>> workers;
+    for (size_t begin = chunk; begin < count; begin += chunk) {
+        workers.push_back(std::async(std::launch::async, derive_range, begin, std::min(count, begin + chunk)));
+    }
+    derive_range(0, std::min(count, chunk));
+    for (std::future<void>& worker : workers) {
+        worker.get();
     }
-    return pubkey;
 }
 
-void CWallet::DeriveNewChildKey(WalletBatch &batch, CKeyMetadata& metadata, CKey& secret, bool internal)
+void CWallet::DeriveNewChildKeys(WalletBatch &batch, const CKeyMetadata& metadata, size_t count, bool internal,
+                                 std::vector<CKey>& secrets, std::vector<CPubKey>& pubkeys, std::vector<CKeyMetadata>& key_metadata)
 {
     // for now we use a fixed keypath scheme of m/0'/0'/k
     CKey seed;                     //seed (256bit)
     CExtKey masterKey;             //hd master key
     CExtKey accountKey;            //key at m/0'
     CExtKey chainChildKey;         //key at m/0'/0' (external) or m/0'/1' (internal)
-    CExtKey childKey;              //key at m/0'/0'/<n>'
 
     // try to get the seed
     if (!GetKey(hdChain.seed_id, seed))
@@ -245,24 +298,27 @@ void CWallet::DeriveNewChildKey(WalletBatch &batch, CKeyMetadata& metadata, CKey
     assert(internal ? CanSupportFeature(FEATURE_HD_SPLIT) : true);
     accountKey.Derive(chainChildKey, BIP32_HARDENED_KEY_LIMIT+(internal ? 1 : 0));
 
-    // derive child key at next index, skip keys already known to the wallet
-    do {
-        // always derive hardened keys
-        // childIndex | BIP32_HARDENED_KEY_LIMIT = derive childIndex in hardened child-index-range
-        // example: 1 | BIP32_HARDENED_KEY_LIMIT == 0x80000001 == 2147483649
-        if (internal) {
-            chainChildKey.Derive(childKey, hdChain.nInternalChainCounter | BIP32_HARDENED_KEY_LIMIT);
-            metadata.hdKeypath = "m/0'/1'/" + std::to_string(hdChain.nInternalChainCounter) + "'";
-            hdChain.nInternalChainCounter++;
-        }
-        else {
-            chainChildKey.Derive(childKey, hdChain.nExternalChainCounter | BIP32_HARDENED_KEY_LIMIT);
-            metadata.hdKeypath = "m/0'/0'/" + std::to_string(hdChain.nExternalChainCounter) + "'";
-            hdChain.nExternalChainCounter++;
+    uint32_t& chain_counter = internal ? hdChain.nInternalChainCounter : hdChain.nExternalChainCounter;
+    const std::string chain_keypath = internal ? "m/0'/1'/" : "m/0'/0'/";
+
+    // derive child keys at the next indexes, skip keys already known to the wallet
+    std::vector<CKey> children;
+    std::vector<CPubKey> child_pubkeys;
+    while (pubkeys.size() < count) {
+        const size_t missing = count - pubkeys.size();
+        DeriveHardenedChildren(chainChildKey, chain_counter, missing, children, child_pubkeys);
+        for (size_t i = 0; i < missing; ++i) {
+            const uint32_t index = chain_counter++;
+            if (HaveKey(child_pubkeys[i].GetID())) {
+                continue;
+            }
+            secrets.push_back(children[i]);
+            pubkeys.push_back(child_pubkeys[i]);
+            key_metadata.push_back(metadata);
+            key_metadata.back().hdKeypath = chain_keypath + std::to_string(index) + "'";
+            key_metadata.back().hd_seed_id = hdChain.seed_id;
         }
-    } while (HaveKey(childKey.key.GetPubKey().GetID()));
-    secret = childKey.key;
-    metadata.hd_seed_id = hdChain.seed_id;
+    }
     // update the chain model in the database
     if (!batch.WriteHDChain(hdChain))
         throw std::runtime_error(std::string(__func__) + ": Writing HD chain model failed");
@@ -628,6 +684,7 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
 void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(std::make_pair(outpoint, wtxid));
+    MarkCreditDirty(outpoint.hash);
 
     setLockedCoins.erase(outpoint);
 
@@ -910,6 +967,112 @@ void CWallet::MarkDirty()
     }
 }
 
+void CWallet::MarkCreditDirty(const uint256& hash) const
+{
+    m_credit_txs_dirty.insert(hash);
+}
+
+bool CWallet::GetCreditOutputs(const CWalletTx& wtx, std::vector<unsigned int>& unspent) const
+{
+    const uint256& hash = wtx.GetHash();
+    bool credit = false;
+    for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
+        if (IsMine(wtx.tx->vout[i]) == ISMINE_NO) continue;
+        if (!IsSpent(hash, i)) {
+            unspent.push_back(i);
+            credit = true;
+        } else if (wtx.IsCoinBase()) {
+            credit = true;
+        }
+    }
+    return credit;
+}
+
+void CWallet::UpdateCreditTxs() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    for (const uint256& hash : m_credit_txs_dirty) {
+        const auto it = mapWallet.find(hash);
+        std::vector<unsigned int> unspent;
+        if (it != mapWallet.end() && GetCreditOutputs(it->second, unspent)) {
+            m_credit_txs[hash] = std::move(unspent);
+        } else {
+            m_credit_txs.erase(hash);
+        }
+    }
+    m_credit_txs_dirty.clear();
+}
+
+std::vector<const CWalletTx*> CWallet::GetCreditTxs() const
+{
+    UpdateCreditTxs();
+
+    std::vector<const CWalletTx*> credit_txs;
+    credit_txs.reserve(m_credit_txs.size());
+    for (const auto& entry : m_credit_txs) {
+        const auto it = mapWallet.find(entry.first);
+        if (it != mapWallet.end()) {
+            credit_txs.push_back(&it->second);
+        }
+    }
+    return credit_txs;
+}
+
+void CWallet::MarkTxHeightDirty(const uint256& hash) const
+{
+    m_tx_heights_dirty.insert(hash);
+}
+
+void CWallet::UpdateTxHeights() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    for (const uint256& hash : m_tx_heights_dirty) {
+        const auto it = mapWallet.find(hash);
+        if (it == mapWallet.end()) continue;
+        const CWalletTx& wtx = it->second;
+        if (wtx.m_filed_height != CWalletTx::NOT_FILED) {
+            m_txs_by_height.erase(std::make_pair(wtx.m_filed_height, hash));
+        }
+        int height = -1;
+        if (!wtx.hashUnset() && wtx.nIndex != -1) {
+            const CBlockIndex* pindex = LookupBlockIndex(wtx.hashBlock);
+            if (pindex && chainActive.Contains(pindex)) {
+                height = pindex->nHeight;
+            }
+        }
+        m_txs_by_height.emplace(height, hash);
+        wtx.m_filed_height = height;
+    }
+    m_tx_heights_dirty.clear();
+}
+
+std::vector<const CWalletTx*> CWallet::GetTxsAboveHeight(int height) const
+{
+    UpdateTxHeights();
+
+    std::set<uint256> hashes;
+    for (auto it = m_txs_by_height.lower_bound(std::make_pair(-1, uint256())); it != m_txs_by_height.end() && it->first == -1; ++it) {
+        hashes.insert(it->second);
+    }
+    for (auto it = m_txs_by_height.lower_bound(std::make_pair(std::max(height + 1, 0), uint256())); it != m_txs_by_height.end(); ++it) {
+        hashes.insert(it->second);
+    }
+
+    std::vector<const CWalletTx*> txs;
+    txs.reserve(hashes.size());
+    for (const uint256& hash : hashes) {
+        const auto it = mapWallet.find(hash);
+        if (it != mapWallet.end()) {
+            txs.push_back(&it->second);
+        }
+    }
+    return txs;
+}
+
 bool CWallet::MarkReplaced(const uint256& originalHash, const uint256& newHash)
 {
     LOCK(cs_wallet);
@@ -1245,6 +1408,18 @@ void CWallet::SyncTransaction(const CTransactionRef& ptx, const CBlockIndex *pin
     MarkInputsDirty(ptx);
 }
 
+bool CWallet::IsWalletTxOrSpend(const CTransaction& tx) const
+{
+    AssertLockHeld(cs_wallet);
+    if (mapWallet.count(tx.GetHash()))
+        return true;
+    for (const CTxIn& txin : tx.vin) {
+        if (mapWallet.count(txin.prevout.hash) || mapTxSpends.count(txin.prevout))
+            return true;
+    }
+    return false;
+}
+
 void CWallet::TransactionAddedToMempool(const CTransactionRef& ptx) {
     LOCK2(cs_main, cs_wallet);
     SyncTransaction(ptx);
@@ -1355,7 +1530,7 @@ CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter& filter) const
 
 isminetype CWallet::IsMine(const CTxOut& txout) const
 {
-    return ::IsMine(*this, txout.scriptPubKey);
+    return IsMineIndexed(txout.scriptPubKey);
 }
 
 CAmount CWallet::GetCredit(const CTxOut& txout, const isminefilter& filter) const
@@ -1379,7 +1554,7 @@ bool CWallet::IsChange(const CScript& script) const
     // a better way of identifying which outputs are 'the send' and which are
     // 'the change' will need to be implemented (maybe extend CWalletTx to remember
     // which output, if any, was change).
-    if (::IsMine(*this, script))
+    if (IsMineIndexed(script))
     {
         CTxDestination address;
         if (!ExtractDestination(script, address))
@@ -1407,6 +1582,15 @@ bool CWallet::IsMine(const CTransaction& tx) const
     return false;
 }
 
+size_t CWallet::GetScriptPubKeys(size_t start, std::vector<CScript>& scripts) const
+{
+    LOCK(cs_KeyStore);
+    for (size_t i = start; i < m_ismine_scripts_order.size(); i++) {
+        scripts.push_back(*m_ismine_scripts_order[i]);
+    }
+    return m_ismine_scripts_order.size();
+}
+
 bool CWallet::IsFromMe(const CTransaction& tx) const
 {
     return (GetDebit(tx, ISMINE_ALL) > 0);
@@ -1558,6 +1742,23 @@ bool CWallet::SetWalletFlags(uint64_t overwriteFlags, bool memonly)
     return true;
 }
 
+void CWalletTx::MarkDirty()
+{
+    fCreditCached = false;
+    fAvailableCreditCached = false;
+    fImmatureCreditCached = false;
+    fWatchDebitCached = false;
+    fWatchCreditCached = false;
+    fAvailableWatchCreditCached = false;
+    fImmatureWatchCreditCached = false;
+    fDebitCached = false;
+    fChangeCached = false;
+    if (pwallet) {
+        pwallet->MarkCreditDirty(GetHash());
+        pwallet->MarkTxHeightDirty(GetHash());
+    }
+}
+
 int64_t CWalletTx::GetTxTime() const
 {
     int64_t n = nTimeSmart;
@@ -1719,6 +1920,111 @@ int64_t CWallet::RescanFromTime(int64_t startTime, const WalletRescanReserver& r
     return startTime;
 }
 
+namespace {
+
+//! Number of blocks ScanForWalletTransactions reads and pre-filters ahead of the one it is applying
+static const size_t RESCAN_READ_AHEAD_BLOCKS = 16;
+
+//! The wallet's scripts, as matched against block filters by ScanForWalletTransactions. Scripts
+//! the wallet learns during the scan go to a small set of recent ones, so that adding them does
+//! not copy all others.
+struct RescanFilterElements {
+    std::shared_ptr<const GCSFilter::ElementSet> base;
+    std::shared_ptr<const GCSFilter::ElementSet> recent;
+    //! Number of the wallet's scripts included, as returned by CWallet::GetScriptPubKeys
+    size_t script_count;
+
+    bool MatchAny(const GCSFilter& filter) const
+    {
+        return filter.MatchAny(*base) || (!recent->empty() && filter.MatchAny(*recent));
+    }
+};
+
+//! Add the scripts the wallet learned since prev was built (everything, if prev is null).
+std::shared_ptr<const RescanFilterElements> UpdateRescanFilterElements(const CWallet& wallet, std::shared_ptr<const RescanFilterElements> prev)
+{
+    std::vector<CScript> scripts;
+    const size_t script_count = wallet.GetScriptPubKeys(prev ? prev->script_count : 0, scripts);
+    if (prev && scripts.empty()) return prev;
+
+    std::shared_ptr<RescanFilterElements> elements = std::make_shared<RescanFilterElements>();
+    elements->script_count = script_count;
+    // Copying the recent scripts costs their number, and folding them into the base costs the
+    // total number, so the recent set is kept to about the square root of the base's size.
+    const size_t recent_size = prev ? prev->recent->size() + scripts.size() : 0;
+    if (prev && recent_size * recent_size <= prev->base->size()) {
+        std::shared_ptr<GCSFilter::ElementSet> recent = std::make_shared<GCSFilter::ElementSet>(*prev->recent);
+        for (const CScript& script : scripts) {
+            recent->emplace(script.begin(), script.end());
+        }
+        elements->base = prev->base;
+        elements->recent = std::move(recent);
+    } else {
+        std::shared_ptr<GCSFilter::ElementSet> base = std::make_shared<GCSFilter::ElementSet>();
+        if (prev) {
+            base->reserve(prev->base->size() + recent_size);
+            base->insert(prev->base->begin(), prev->base->end());
+            base->insert(prev->recent->begin(), prev->recent->end());
+        }
+        for (const CScript& script : scripts) {
+            base->emplace(script.begin(), script.end());
+        }
+        elements->base = std::move(base);
+        elements->recent = std::make_shared<const GCSFilter::ElementSet>();
+    }
+    return elements;
+}
+
+//! A block read ahead by ScanForWalletTransactions
+struct RescanBlock {
+    CBlockIndex* pindex;
+    //! The wallet's m_max_keypool_index when is_mine was computed
+    int64_t keypool_index;
+    bool read_ok;
+    //! Whether the block filter showed the block cannot affect the wallet, so it was not read
+    bool filtered_out{false};
+    //! The scripts the block filter was matched against, if it was
+    std::shared_ptr<const RescanFilterElements> filter_elements;
+    CBlock block;
+    //! Per transaction: whether it pays to the wallet
+    std::vector<bool> is_mine;
+};
+
+//! Read a block and find the transactions paying to the wallet. Runs on a read-ahead thread,
+//! without cs_main or cs_wallet: the caller looks up block_pos, and IsMine only consults the
+//! key store, which has its own lock.
+//! If filter_elements is set and the block filter index has the block, the block is only
+//! read when its filter matches one of the wallet's scripts.
+std::shared_ptr<RescanBlock> ReadRescanBlock(const CWallet* wallet, CBlockIndex* pindex, const CDiskBlockPos& block_pos, int64_t keypool_index,
+                                             std::shared_ptr<const RescanFilterElements> filter_elements)
+{
+    std::shared_ptr<RescanBlock> rescan_block = std::make_shared<RescanBlock>();
+    rescan_block->pindex = pindex;
+    rescan_block->keypool_index = keypool_index;
+    BlockFilter filter;
+    if (filter_elements && g_blockfilterindex && g_blockfilterindex->LookupFilter(pindex, filter) &&
+        !filter_elements->MatchAny(filter.GetFilter())) {
+        rescan_block->read_ok = true;
+        rescan_block->filtered_out = true;
+        rescan_block->filter_elements = std::move(filter_elements);
+        return rescan_block;
+    }
+    rescan_block->read_ok = ReadBlockFromDisk(rescan_block->block, block_pos, Params().GetConsensus());
+    if (rescan_block->read_ok && rescan_block->block.GetHash() != pindex->GetBlockHash()) {
+        rescan_block->read_ok = error("%s: GetHash() doesn't match index for %s at %s", __func__,
+                                      pindex->GetBlockHash().ToString(), block_pos.ToString());
+    }
+    if (rescan_block->read_ok) {
+        rescan_block->is_mine.reserve(rescan_block->block.vtx.size());
+        for (const CTransactionRef& tx : rescan_block->block.vtx) {
+            rescan_block->is_mine.push_back(wallet->IsMine(*tx));
+        }
+    }
+    return rescan_block;
+}
+
+} // namespace
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
@@ -1767,6 +2073,83 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
             }
         }
         double progress_current = progress_begin;
+
+        // Blocks are read, and checked for outputs paying to us, on read-ahead threads.
+        // Only transactions that can affect the wallet are then applied under cs_wallet.
+        std::deque<std::pair<CBlockIndex*, std::future<std::shared_ptr<RescanBlock>>>> read_ahead;
+        // Read-aheads that turned out not to be needed. Destroying a future waits for its
+        // read to finish, so this is only cleared after cs_main and cs_wallet are released.
+        std::deque<std::pair<CBlockIndex*, std::future<std::shared_ptr<RescanBlock>>>> read_ahead_stale;
+        // With a block filter index, blocks whose filter matches none of our scripts are skipped.
+        // filter_elements is what read-aheads match against: the wallet's scripts, or null while
+        // blocks must not be skipped.
+        std::shared_ptr<const RescanFilterElements> wallet_scripts;
+        std::shared_ptr<const RescanFilterElements> filter_elements;
+        // Unconfirmed wallet transactions spending outputs that are not ours. A block with a
+        // conflicting spend of such an output need not involve any of our scripts, but has to be
+        // scanned to mark the transaction conflicted, so no block is skipped while there are any.
+        // As the scan goes on, they can only get confirmed or conflicted.
+        std::vector<uint256> foreign_spends;
+        bool foreign_spends_known = false;
+        const auto read_more = [&]() {
+            AssertLockHeld(cs_main);
+            AssertLockHeld(cs_wallet);
+            if (g_blockfilterindex) {
+                if (!foreign_spends_known) {
+                    for (const auto& entry : mapWallet) {
+                        const CWalletTx& wtx = entry.second;
+                        if (wtx.IsCoinBase() || wtx.GetDepthInMainChain() != 0) continue;
+                        for (const CTxIn& txin : wtx.tx->vin) {
+                            if (!IsMine(txin)) {
+                                foreign_spends.push_back(entry.first);
+                                break;
+                            }
+                        }
+                    }
+                    foreign_spends_known = true;
+                }
+                foreign_spends.erase(std::remove_if(foreign_spends.begin(), foreign_spends.end(), [this](const uint256& hash) {
+                    AssertLockHeld(cs_main);
+                    AssertLockHeld(cs_wallet);
+                    auto it = mapWallet.find(hash);
+                    return it == mapWallet.end() || it->second.GetDepthInMainChain() != 0;
+                }), foreign_spends.end());
+                if (foreign_spends.empty()) {
+                    wallet_scripts = UpdateRescanFilterElements(*this, std::move(wallet_scripts));
+                    filter_elements = wallet_scripts;
+                } else {
+                    filter_elements = nullptr;
+                }
+            }
+            if (!read_ahead.empty() && read_ahead.front().first != pindex) {
+                // The chain changed under us; what was read ahead is not what we will scan.
+                read_ahead_stale.swap(read_ahead);
+                read_ahead.clear();
+            }
+            while (pindex && read_ahead.size() < RESCAN_READ_AHEAD_BLOCKS) {
+                CBlockIndex* pindex_read = pindex;
+                if (!read_ahead.empty()) {
+                    if (read_ahead.back().first == pindexStop) break;
+                    pindex_read = chainActive.Next(read_ahead.back().first);
+                    if (!pindex_read) break;
+                }
+                read_ahead.emplace_back(pindex_read, std::async(std::launch::async, ReadRescanBlock, this, pindex_read, pindex_read->GetBlockPos(), m_max_keypool_index, filter_elements));
+            }
+        };
+        const auto read_now = [&]() {
+            // A keypool index of -1 never matches, so is_mine is recomputed under the lock below.
+            CDiskBlockPos block_pos;
+            {
+                LOCK(cs_main);
+                block_pos = pindex->GetBlockPos();
+            }
+            return ReadRescanBlock(this, pindex, block_pos, -1, nullptr);
+        };
+        {
+            LOCK2(cs_main, cs_wallet);
+            read_more();
+        }
+
         while (pindex && !fAbortRescan && !ShutdownRequested())
         {
             if (pindex->nHeight % 100 == 0 && progress_end - progress_begin > 0.0) {
@@ -1777,8 +2160,23 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
                 WalletLogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, progress_current);
             }
 
-            CBlock block;
-            if (ReadBlockFromDisk(block, pindex, Params().GetConsensus())) {
+            std::shared_ptr<RescanBlock> rescan_block;
+            if (!read_ahead.empty() && read_ahead.front().first == pindex) {
+                rescan_block = read_ahead.front().second.get();
+                read_ahead.pop_front();
+            } else {
+                rescan_block = read_now();
+            }
+            if (rescan_block->filtered_out) {
+                // Scripts the wallet learned since the block was filtered were not looked for, and
+                // blocks may not be skipped at all anymore.
+                std::vector<CScript> new_scripts;
+                if (rescan_block->filter_elements != filter_elements ||
+                    GetScriptPubKeys(filter_elements->script_count, new_scripts) != filter_elements->script_count) {
+                    rescan_block = read_now();
+                }
+            }
+            if (rescan_block->read_ok) {
                 LOCK2(cs_main, cs_wallet);
                 if (pindex && !chainActive.Contains(pindex)) {
                     // Abort scan if current block is no longer active, to prevent
@@ -1786,8 +2184,14 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
                     ret = pindex;
                     break;
                 }
+                const CBlock& block = rescan_block->block;
                 for (size_t posInBlock = 0; posInBlock < block.vtx.size(); ++posInBlock) {
-                    SyncTransaction(block.vtx[posInBlock], pindex, posInBlock, fUpdate);
+                    // New keypool keys (topped up after one of ours was seen in use) may
+                    // make is_mine stale, so recheck in that case.
+                    const bool is_mine = rescan_block->keypool_index == m_max_keypool_index ? rescan_block->is_mine[posInBlock] : IsMine(*block.vtx[posInBlock]);
+                    if (is_mine || IsWalletTxOrSpend(*block.vtx[posInBlock])) {
+                        SyncTransaction(block.vtx[posInBlock], pindex, posInBlock, fUpdate);
+                    }
                 }
             } else {
                 ret = pindex;
@@ -1796,8 +2200,9 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
                 break;
             }
             {
-                LOCK(cs_main);
+                LOCK2(cs_main, cs_wallet);
                 pindex = chainActive.Next(pindex);
+                read_more();
                 progress_current = GuessVerificationProgress(chainParams.TxData(), pindex);
                 if (pindexStop == nullptr && tip != chainActive.Tip()) {
                     tip = chainActive.Tip();
@@ -1805,6 +2210,7 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
                     progress_end = GuessVerificationProgress(chainParams.TxData(), tip);
                 }
             }
+            read_ahead_stale.clear();
         }
         if (pindex && fAbortRescan) {
             WalletLogPrintf("Rescan aborted at block %d. Progress=%f\n", pindex->nHeight, progress_current);
@@ -2135,9 +2541,8 @@ CAmount CWallet::GetBalance(const isminefilter& filter, const int min_depth) con
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (const auto& entry : mapWallet)
+        for (const CWalletTx* pcoin : GetCreditTxs())
         {
-            const CWalletTx* pcoin = &entry.second;
             if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() >= min_depth) {
                 nTotal += pcoin->GetAvailableCredit(true, filter);
             }
@@ -2152,9 +2557,8 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (const auto& entry : mapWallet)
+        for (const CWalletTx* pcoin : GetCreditTxs())
         {
-            const CWalletTx* pcoin = &entry.second;
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -2167,9 +2571,8 @@ CAmount CWallet::GetImmatureBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (const auto& entry : mapWallet)
+        for (const CWalletTx* pcoin : GetCreditTxs())
         {
-            const CWalletTx* pcoin = &entry.second;
             nTotal += pcoin->GetImmatureCredit();
         }
     }
@@ -2181,9 +2584,8 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (const auto& entry : mapWallet)
+        for (const CWalletTx* pcoin : GetCreditTxs())
         {
-            const CWalletTx* pcoin = &entry.second;
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableCredit(true, ISMINE_WATCH_ONLY);
         }
@@ -2196,9 +2598,8 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (const auto& entry : mapWallet)
+        for (const CWalletTx* pcoin : GetCreditTxs())
         {
-            const CWalletTx* pcoin = &entry.second;
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
     }
@@ -2271,10 +2672,15 @@ void CWallet::AvailableCoins(std::vector<COutput> &vCoins, bool fOnlySafe, const
     vCoins.clear();
     CAmount nTotal = 0;
 
-    for (const auto& entry : mapWallet)
+    // Only transactions with unspent outputs of ours need to be looked at.
+    UpdateCreditTxs();
+    for (const auto& entry : m_credit_txs)
     {
         const uint256& wtxid = entry.first;
-        const CWalletTx* pcoin = &entry.second;
+        const auto it = mapWallet.find(wtxid);
+        if (it == mapWallet.end())
+            continue;
+        const CWalletTx* pcoin = &it->second;
 
         if (!CheckFinalTx(*pcoin->tx))
             continue;
@@ -2331,7 +2737,7 @@ void CWallet::AvailableCoins(std::vector<COutput> &vCoins, bool fOnlySafe, const
         if (nDepth < nMinDepth || nDepth > nMaxDepth)
             continue;
 
-        for (unsigned int i = 0; i < pcoin->tx->vout.size(); i++) {
+        for (unsigned int i : entry.second) {
             if (pcoin->tx->vout[i].nValue < nMinimumAmount || pcoin->tx->vout[i].nValue > nMaximumAmount)
                 continue;
 
@@ -3196,6 +3602,9 @@ DBErrors CWallet::ZapSelectTx(std::vector<uint256>& vHashIn, std::vector<uint256
     for (uint256 hash : vHashOut) {
         const auto& it = mapWallet.find(hash);
         wtxOrdered.erase(it->second.m_it_wtxOrdered);
+        if (it->second.m_filed_height != CWalletTx::NOT_FILED) {
+            m_txs_by_height.erase(std::make_pair(it->second.m_filed_height, hash));
+        }
         mapWallet.erase(it);
     }
 
@@ -3391,28 +3800,42 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
             // don't create extra internal keys
             missingInternal = 0;
         }
-        bool internal = false;
-        WalletBatch batch(*database);
-        for (int64_t i = missingInternal + missingExternal; i--;)
-        {
-            if (i < missingInternal) {
-                internal = true;
-            }
+        // Each key takes at most four records: the key, its metadata, its pool
+        // entry and the HD chain state.
+        const int64_t max_keys_per_checkpoint = WalletBatchScope::MAX_WRITES / 4;
+        WalletBatchScope batch_scope(*database);
+        for (bool internal : {false, true}) {
+            int64_t missing = internal ? missingInternal : missingExternal;
+            while (missing > 0) {
+                const int64_t count = std::min(missing, max_keys_per_checkpoint);
+                missing -= count;
 
-            assert(m_max_keypool_index < std::numeric_limits<int64_t>::max()); // How in the hell did you use so many keys?
-            int64_t index = ++m_max_keypool_index;
-
-            CPubKey pubkey(GenerateNewKey(batch, internal));
-            if (!batch.WritePool(index, CKeyPool(pubkey, internal))) {
-                throw std::runtime_error(std::string(__func__) + ": writing generated key failed");
-            }
+                {
+                    WalletBatch batch(*database);
+                    // Derive the keys of a chunk at once, so that it is done in parallel.
+                    for (const CPubKey& pubkey : GenerateNewKeys(batch, count, internal)) {
+                        assert(m_max_keypool_index < std::numeric_limits<int64_t>::max()); // How in the hell did you use so many keys?
+                        int64_t index = ++m_max_keypool_index;
+
+                        if (!batch.WritePool(index, CKeyPool(pubkey, internal))) {
+                            throw std::runtime_error(std::string(__func__) + ": writing generated key failed");
+                        }
 
-            if (internal) {
-                setInternalKeyPool.insert(index);
-            } else {
-                setExternalKeyPool.insert(index);
+                        if (internal) {
+                            setInternalKeyPool.insert(index);
+                        } else {
+                            setExternalKeyPool.insert(index);
+                        }
+                        m_pool_key_to_index[pubkey.GetID()] = index;
+                    }
+                }
+                if (!batch_scope.Checkpoint()) {
+                    throw std::runtime_error(std::string(__func__) + ": writing generated keys failed");
+                }
             }
-            m_pool_key_to_index[pubkey.GetID()] = index;
+        }
+        if (!batch_scope.Commit()) {
+            throw std::runtime_error(std::string(__func__) + ": writing generated keys failed");
         }
         if (missingInternal + missingExternal > 0) {
             WalletLogPrintf("keypool added %d keys (%d internal), size=%u (%u internal)\n", missingInternal + missingExternal, missingInternal, setInternalKeyPool.size() + setExternalKeyPool.size() + set_pre_split_keypool.size(), setInternalKeyPool.size());
@@ -340,6 +340,9 @@ public:
     std::string strFromAccount;
     int64_t nOrderPos; //!< position in ordered transaction list
     std::multimap<int64_t, std::pair<CWalletTx*, CAccountingEntry*>>::const_iterator m_it_wtxOrdered;
+    //! Height this transaction is filed under in CWallet::m_txs_by_height, or NOT_FILED
+    mutable int m_filed_height;
+    static constexpr int NOT_FILED = -2;
 
     // memory only
     mutable bool fDebitCached;
@@ -397,6 +400,7 @@ public:
         nImmatureWatchCreditCached = 0;
         nChangeCached = 0;
         nOrderPos = -1;
+        m_filed_height = NOT_FILED;
     }
 
     template<typename Stream>
@@ -437,18 +441,7 @@ public:
     }
 
     //! make sure balances are recalculated
-    void MarkDirty()
-    {
-        fCreditCached = false;
-        fAvailableCreditCached = false;
-        fImmatureCreditCached = false;
-        fWatchDebitCached = false;
-        fWatchCreditCached = false;
-        fAvailableWatchCreditCached = false;
-        fImmatureWatchCreditCached = false;
-        fDebitCached = false;
-        fChangeCached = false;
-    }
+    void MarkDirty();
 
     void BindWallet(CWallet *pwalletIn)
     {
@@ -696,6 +689,42 @@ private:
     void AddToSpends(const COutPoint& outpoint, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    /**
+     * Transactions that can count towards a balance: those with an output of ours
+     * that is not spent, and coinbases paying to us (immature credit counts spent
+     * outputs too). Each is mapped to its unspent outputs of ours, so this is also
+     * the wallet's UTXO set. Fully spent transactions, usually the vast majority,
+     * are left out, so balances and AvailableCoins only look at these instead of
+     * all of mapWallet.
+     */
+    mutable std::map<uint256, std::vector<unsigned int>> m_credit_txs;
+    //! Transactions whose entry in m_credit_txs needs to be re-evaluated
+    mutable std::set<uint256> m_credit_txs_dirty;
+
+    //! Find a transaction's unspent outputs of ours. Returns whether it belongs in m_credit_txs.
+    bool GetCreditOutputs(const CWalletTx& wtx, std::vector<unsigned int>& unspent) const EXCLUSIVE_LOCKS_REQUIRED(cs_main, cs_wallet);
+
+    //! Bring m_credit_txs up to date
+    void UpdateCreditTxs() const EXCLUSIVE_LOCKS_REQUIRED(cs_main, cs_wallet);
+
+    //! Bring m_credit_txs up to date and return its transactions
+    std::vector<const CWalletTx*> GetCreditTxs() const EXCLUSIVE_LOCKS_REQUIRED(cs_main, cs_wallet);
+
+    /**
+     * Transactions by the height of the active chain block that confirms them,
+     * with -1 for those not confirmed in the active chain: unconfirmed, abandoned
+     * and conflicted transactions, and those in a disconnected block. Lets
+     * listsinceblock visit recent transactions only instead of all of mapWallet.
+     * Each transaction remembers the height it is filed under in
+     * CWalletTx::m_filed_height.
+     */
+    mutable std::set<std::pair<int, uint256>> m_txs_by_height;
+    //! Transactions whose entry in m_txs_by_height needs to be re-evaluated
+    mutable std::set<uint256> m_tx_heights_dirty;
+
+    //! Bring m_txs_by_height up to date
+    void UpdateTxHeights() const EXCLUSIVE_LOCKS_REQUIRED(cs_main, cs_wallet);
+
     /**
      * Add a transaction to the wallet, or update it.  pIndex and posInBlock should
      * be set when the transaction was known to be included in a block.  When
@@ -723,11 +752,17 @@ private:
      * Should be called with pindexBlock and posInBlock if this is for a transaction that is included in a block. */
     void SyncTransaction(const CTransactionRef& tx, const CBlockIndex *pindex = nullptr, int posInBlock = 0, bool update_tx = true) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
 
+    /* Whether a transaction paying nothing to us can still affect the wallet: it is a wallet
+     * transaction, spends an output of one, or conflicts with one. */
+    bool IsWalletTxOrSpend(const CTransaction& tx) const EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+
     /* the HD chain data model (external chain counters) */
     CHDChain hdChain;
 
-    /* HD derive new child key (on internal or external chain) */
-    void DeriveNewChildKey(WalletBatch &batch, CKeyMetadata& metadata, CKey& secret, bool internal = false) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    /* HD derive count new child keys (on internal or external chain), in parallel, with their
+     * public keys and metadata based on the given one, and write the chain model once */
+    void DeriveNewChildKeys(WalletBatch &batch, const CKeyMetadata& metadata, size_t count, bool internal,
+                            std::vector<CKey>& secrets, std::vector<CPubKey>& pubkeys, std::vector<CKeyMetadata>& key_metadata) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
 
     std::set<int64_t> setInternalKeyPool;
     std::set<int64_t> setExternalKeyPool;
@@ -893,6 +928,8 @@ public:
      * Generate a new key
      */
     CPubKey GenerateNewKey(WalletBatch& batch, bool internal = false) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
+    //! Generate count new keys at once, deriving HD keys in parallel
+    std::vector<CPubKey> GenerateNewKeys(WalletBatch& batch, size_t count, bool internal = false) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
     //! Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey) override EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
     bool AddKeyPubKeyWithDB(WalletBatch &batch,const CKey& key, const CPubKey &pubkey) EXCLUSIVE_LOCKS_REQUIRED(cs_wallet);
@@ -949,6 +986,15 @@ public:
     bool GetLabelDestination(CTxDestination &dest, const std::string& label, bool bForceNew = false);
 
     void MarkDirty();
+    //! Note that the outputs or spends of a transaction changed, see m_credit_txs
+    void MarkCreditDirty(const uint256& hash) const;
+    //! Note that the block of a transaction may have changed, see m_txs_by_height
+    void MarkTxHeightDirty(const uint256& hash) const;
+    /**
+     * Return the transactions that are not confirmed in the active chain, or are
+     * confirmed in a block above the given height, in txid order.
+     */
+    std::vector<const CWalletTx*> GetTxsAboveHeight(int height) const EXCLUSIVE_LOCKS_REQUIRED(cs_main, cs_wallet);
     bool AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose=true);
     void LoadToWallet(const CWalletTx& wtxIn);
     void TransactionAddedToMempool(const CTransactionRef& tx) override;
@@ -1062,6 +1108,16 @@ public:
     bool IsChange(const CScript& script) const;
     CAmount GetChange(const CTxOut& txout) const;
     bool IsMine(const CTransaction& tx) const;
+    /**
+     * Returns the output scripts the wallet could consider its own: every form of
+     * every key's scripts, every known script wrapped in P2SH and P2WSH, and every
+     * watch-only script. This is a superset of what IsMine accepts.
+     * Scripts are appended to scripts in the order the wallet learned them,
+     * skipping the first start ones, and the total number is returned. As
+     * scripts are never forgotten, passing a previous return value as start
+     * yields only the ones learned since.
+     */
+    size_t GetScriptPubKeys(size_t start, std::vector<CScript>& scripts) const;
     /** should probably be renamed to IsRelevantToMe */
     bool IsFromMe(const CTransaction& tx) const;
     CAmount GetDebit(const CTransaction& tx, const isminefilter& filter) const;
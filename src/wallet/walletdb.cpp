@@ -747,6 +747,35 @@ DBErrors WalletBatch::ZapWalletTx(std::vector<CWalletTx>& vWtx)
     return DBErrors::LOAD_OK;
 }
 
+WalletBatchScope::WalletBatchScope(WalletDatabase& database) : m_batch(database), m_failed(false)
+{
+    // Nested in another scope, or on a dummy database: writes are left as they are.
+    m_active = m_batch.TxnBeginShared();
+}
+
+bool WalletBatchScope::Commit()
+{
+    if (!m_active) {
+        return !m_failed;
+    }
+    m_active = false;
+    m_failed = !m_batch.TxnCommitShared();
+    return !m_failed;
+}
+
+bool WalletBatchScope::Checkpoint()
+{
+    if (!m_active) {
+        return !m_failed;
+    }
+    if (!m_batch.TxnRenewShared(MAX_WRITES)) {
+        // The writes since the last checkpoint may have been lost
+        m_active = false;
+        m_failed = true;
+    }
+    return !m_failed;
+}
+
 void MaybeCompactWalletDB()
 {
     static std::atomic<bool> fOneThread(false);
@@ -861,6 +890,21 @@ bool WalletBatch::TxnAbort()
     return m_batch.TxnAbort();
 }
 
+bool WalletBatch::TxnBeginShared()
+{
+    return m_batch.TxnBeginShared();
+}
+
+bool WalletBatch::TxnCommitShared()
+{
+    return m_batch.TxnCommitShared();
+}
+
+bool WalletBatch::TxnRenewShared(unsigned int max_writes)
+{
+    return m_batch.TxnRenewShared(max_writes);
+}
+
 bool WalletBatch::ReadVersion(int& nVersion)
 {
     return m_batch.ReadVersion(nVersion);
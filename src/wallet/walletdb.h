@@ -269,6 +269,12 @@ public:
     bool TxnCommit();
     //! Abort current transaction
     bool TxnAbort();
+    //! Begin a transaction shared by every batch opened on the database until it is committed
+    bool TxnBeginShared();
+    //! Commit the shared transaction begun by this batch
+    bool TxnCommitShared();
+    //! Commit the shared transaction begun by this batch and begin a new one once it holds max_writes records
+    bool TxnRenewShared(unsigned int max_writes);
     //! Read wallet version
     bool ReadVersion(int& nVersion);
     //! Write wallet version
@@ -278,6 +284,42 @@ private:
     WalletDatabase& m_database;
 };
 
+/** Groups the writes of every batch opened on a wallet database while it is in
+ * scope into a single database transaction, committed and flushed to disk once
+ * instead of once per write. Meant for bulk operations such as imports and
+ * keypool top-ups, which otherwise open a batch, and flush it, for each key,
+ * script or address book entry they write. Scopes nest: an inner scope joins
+ * the outermost one. Only batches opened by the thread that created the scope
+ * join it; batches opened elsewhere meanwhile, e.g. by the scheduler thread,
+ * keep their own transactions. Batches must be closed before Commit() or
+ * Checkpoint() is called.
+ */
+class WalletBatchScope
+{
+public:
+    explicit WalletBatchScope(WalletDatabase& database);
+    ~WalletBatchScope() { Commit(); }
+
+    WalletBatchScope(const WalletBatchScope&) = delete;
+    WalletBatchScope& operator=(const WalletBatchScope&) = delete;
+
+    //! Commit the writes made so far, ending the scope early. Returns false if that fails.
+    bool Commit();
+    //! Commit the writes made so far and continue in a new transaction, if
+    //! they number at least MAX_WRITES. Returns false if that fails.
+    bool Checkpoint();
+
+    /** Writes after which Checkpoint() commits. Bounds the page locks held by
+     * one transaction to far below the 40000 (10000 for mock databases) the
+     * environment allows: a 100k key import writes around 300k records. */
+    static constexpr unsigned int MAX_WRITES = 10000;
+
+private:
+    WalletBatch m_batch;
+    bool m_active;
+    bool m_failed;
+};
+
 //! Compacts BDB state so that wallet.dat is self-contained (if there are changes)
 void MaybeCompactWalletDB();
 
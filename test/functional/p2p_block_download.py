@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test adaptive block download from peers of different speeds.
+
+Setup: one node, with a slow and a fast P2P connection to it.
+
+1. Only the slow peer announces a short chain, and serves each block it is
+   asked for 1.5 seconds after the previous one. The node's in-flight limit
+   for it drops from the default 16 to the minimum of 4.
+
+2. The slow peer announces 8 more blocks, few enough for the node to fetch
+   them directly on receiving the headers. It only requests 4 of them, which
+   the slow peer then withholds.
+
+3. The fast peer announces a chain longer than the block download window and
+   serves blocks straight away. The node downloads the rest of the window from
+   it, raising its in-flight limit, and then re-requests the blocks stalling
+   the window from the fast peer instead of disconnecting the slow one.
+"""
+
+import time
+
+from test_framework.blocktools import create_block, create_coinbase
+from test_framework.messages import CBlockHeader, msg_block, msg_headers
+from test_framework.mininode import mininode_lock, P2PDataStore
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, wait_until
+
+# Must match BLOCK_DOWNLOAD_WINDOW and MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER in validation.h
+BLOCK_DOWNLOAD_WINDOW = 1024
+MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 4
+DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER = 16
+
+SLOW_PEER_DELAY = 1.5
+
+
+class BlockDownloadTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def build_chain(self, count):
+        """Extend self.blocks by count blocks."""
+        for _ in range(count):
+            height = len(self.blocks) + 1
+            block = create_block(self.tip, create_coinbase(height), self.block_time)
+            block.solve()
+            self.blocks.append(block)
+            self.tip = block.sha256
+            self.block_time += 1
+
+    def announce(self, peer, blocks):
+        peer.send_message(msg_headers([CBlockHeader(b) for b in blocks]))
+
+    def wait_for_requests(self, peer, blocks):
+        wait_until(lambda: all(b.sha256 in peer.getdata_requests for b in blocks), timeout=30, lock=mininode_lock)
+
+    def inflight_limits(self):
+        return [peer['inflight_limit'] for peer in self.nodes[0].getpeerinfo()]
+
+    def run_test(self):
+        node = self.nodes[0]
+        self.blocks = []
+        self.tip = int(node.getbestblockhash(), 16)
+        self.block_time = int(time.time()) - 600
+
+        slow = node.add_p2p_connection(P2PDataStore())
+        assert_equal(self.inflight_limits(), [DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER])
+
+        self.log.info("A slowly served chain lowers the slow peer's in-flight limit")
+        self.build_chain(MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER)
+        self.announce(slow, self.blocks)
+        self.wait_for_requests(slow, self.blocks)
+        for block in self.blocks:
+            time.sleep(SLOW_PEER_DELAY)
+            slow.send_message(msg_block(block))
+        slow.sync_with_ping()
+        assert_equal(node.getblockcount(), len(self.blocks))
+        assert_equal(self.inflight_limits(), [MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER])
+
+        self.log.info("The slow peer is only asked for as many blocks as its limit")
+        start_height = len(self.blocks)
+        self.build_chain(2 * MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER)
+        new_blocks = self.blocks[start_height:]
+        stalling_blocks = new_blocks[:MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER]
+        self.announce(slow, new_blocks)
+        self.wait_for_requests(slow, stalling_blocks)
+        slow.sync_with_ping()
+        with mininode_lock:
+            assert_equal(len(slow.getdata_requests), start_height + len(stalling_blocks))
+
+        self.log.info("The fast peer raises its limit and takes over the stalling blocks")
+        self.build_chain(BLOCK_DOWNLOAD_WINDOW + 64)
+        new_blocks = self.blocks[start_height:]
+        fast = node.add_p2p_connection(P2PDataStore())
+        for block in self.blocks:
+            fast.block_store[block.sha256] = block
+        fast.last_block_hash = self.tip
+        self.announce(fast, new_blocks)
+        wait_until(lambda: node.getblockcount() == len(self.blocks), timeout=120)
+        assert_equal(node.getbestblockhash(), self.blocks[-1].hash)
+        self.wait_for_requests(fast, stalling_blocks)
+
+        # The slow peer was not disconnected for stalling, and each peer keeps
+        # the limit that matches its speed.
+        slow_limit, fast_limit = self.inflight_limits()
+        assert_equal(slow_limit, MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER)
+        assert fast_limit > DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER
+
+
+if __name__ == '__main__':
+    BlockDownloadTest().main()
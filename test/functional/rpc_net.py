@@ -104,6 +104,9 @@ class NetTest(BitcoinTestFramework):
         assert_equal(peer_info[1][0]['addrbind'], peer_info[0][0]['addr'])
         assert_equal(peer_info[0][0]['minfeefilter'], Decimal("0.00000500"))
         assert_equal(peer_info[1][0]['minfeefilter'], Decimal("0.00001000"))
+        # No blocks have been downloaded yet, so the default in-flight limit applies
+        assert_equal(peer_info[0][0]['inflight_limit'], 16)
+        assert 'block_download_rate' not in peer_info[0][0]
 
     def _test_getnodeaddresses(self):
         self.nodes[0].add_p2p_connection(P2PInterface())
@@ -149,6 +149,7 @@ BASE_SCRIPTS = [
     'feature_minchainwork.py',
     'rpc_getblockstats.py',
     'p2p_fingerprint.py',
+    'p2p_block_download.py',
     'feature_uacomment.py',
     'p2p_unrequested_blocks.py',
     'feature_includeconf.py',
@@ -103,6 +103,7 @@ class ListTransactionsTest(BitcoinTestFramework):
                             {"txid": txid, "label": "watchonly"})
 
         self.run_rbf_opt_in_test()
+        self.run_cursor_test()
 
     # Check that the opt-in-rbf flag works properly, for sent and received
     # transactions.
@@ -206,5 +207,26 @@ class ListTransactionsTest(BitcoinTestFramework):
         assert_equal(self.nodes[0].gettransaction(txid_3b)["bip125-replaceable"], "no")
         assert_equal(self.nodes[0].gettransaction(txid_4)["bip125-replaceable"], "unknown")
 
+    # Check that paging with the cursor lists every entry exactly once
+    def run_cursor_test(self):
+        def key(entry):
+            return (entry["orderpos"], entry.get("txid"), entry["category"], entry.get("vout"))
+
+        node = self.nodes[0]
+        full = node.listtransactions("*", 1000)
+        assert len(full) > 10
+        paged = []
+        page = node.listtransactions("*", 3, 0, False, -1)
+        while page:
+            assert len(page) >= 3 or key(page[0]) == key(full[0])
+            paged = page + paged
+            page = node.listtransactions("*", 3, 0, False, page[0]["orderpos"])
+        assert_equal([key(e) for e in paged], [key(e) for e in full])
+
+        # skip counts entries from the cursor on
+        cursor = full[-5]["orderpos"]
+        before = [e for e in full if e["orderpos"] < cursor]
+        assert_equal([key(e) for e in node.listtransactions("*", 2, 1, False, cursor)[-2:]], [key(e) for e in before[-3:-1]])
+
 if __name__ == '__main__':
     ListTransactionsTest().main()